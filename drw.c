@@ -75,6 +75,8 @@ Drw *drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned
 	drw->picture = XRenderCreatePicture(
 		dpy, drw->drawable,
 		XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen)), 0, NULL);
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable, DefaultVisual(dpy, screen),
+				     DefaultColormap(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -83,10 +85,11 @@ Drw *drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned
 
 void drw_resize(Drw *drw, unsigned int w, unsigned int h)
 {
-	if (!drw) return;
+	if (!drw || (w == drw->w && h == drw->h)) return;
 
 	drw->w = w;
 	drw->h = h;
+	if (drw->xftdraw) XftDrawDestroy(drw->xftdraw);
 	if (drw->picture) XRenderFreePicture(drw->dpy, drw->picture);
 	if (drw->drawable) XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h,
@@ -95,10 +98,17 @@ void drw_resize(Drw *drw, unsigned int w, unsigned int h)
 		drw->dpy, drw->drawable,
 		XRenderFindVisualFormat(drw->dpy, DefaultVisual(drw->dpy, drw->screen)),
 		0, NULL);
+	drw->xftdraw = XftDrawCreate(drw->dpy, drw->drawable,
+				     DefaultVisual(drw->dpy, drw->screen),
+				     DefaultColormap(drw->dpy, drw->screen));
 }
 
 void drw_free(Drw *drw)
 {
+	size_t i;
+
+	for (i = 0; i < COVERPAGES; i++) free(drw->cover[i]);
+	XftDrawDestroy(drw->xftdraw);
 	XRenderFreePicture(drw->dpy, drw->picture);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
@@ -264,6 +274,168 @@ xfont_free(Fnt *font)
 	free(font);
 }
 
+/* Indexes the font set and forgets everything cached about the old one. */
+static void
+fontset_reset(Drw *drw)
+{
+	Fnt *font;
+	size_t i;
+
+	drw->nfonts = 0;
+	for (font = drw->fonts; font && drw->nfonts < COVERFONTS; font = font->next)
+		drw->fontv[drw->nfonts++] = font;
+	drw->nprimary = drw->nfonts;
+	for (i = 0; i < COVERPAGES; i++) {
+		free(drw->cover[i]);
+		drw->cover[i] = NULL;
+	}
+	memset(drw->ascii, 0, sizeof drw->ascii);
+	memset(drw->glyphs, 0, sizeof drw->glyphs);
+	memset(drw->widths, 0, sizeof drw->widths);
+}
+
+/* Unloads the least recently used fallback font and forgets every codepoint
+ * it was drawing. Returns the index it held in fontv.
+ */
+static unsigned int
+fallback_evict(Drw *drw)
+{
+	Fnt *font, **fp;
+	unsigned int i, lru = drw->nprimary;
+	size_t j, k;
+
+	for (i = drw->nprimary + 1; i < drw->nfonts; i++)
+		if (drw->fontv[i]->used < drw->fontv[lru]->used) lru = i;
+	font = drw->fontv[lru];
+
+	for (j = 0; j < COVERPAGES; j++)
+		if (drw->cover[j])
+			for (k = 0; k < 256; k++)
+				if (drw->cover[j][k] == lru + 1)
+					drw->cover[j][k] = CoverUnknown;
+	for (k = 0; k < 128; k++)
+		if (drw->ascii[k].font == font) drw->ascii[k].font = NULL;
+	for (k = 0; k < GLYPHCACHE; k++)
+		if (drw->glyphs[k].font == font) drw->glyphs[k].font = NULL;
+
+	for (fp = &drw->fonts; *fp != font; fp = &(*fp)->next)
+		; /* NOP */
+	*fp = font->next;
+	xfont_free(font);
+	drw->evictions++;
+	return lru;
+}
+
+/* Finds a font with a glyph for codepoint through fontconfig and appends it
+ * to the font set, making room among the fallback fonts if needed. Returns
+ * NULL if no font has it.
+ */
+static Fnt *
+fallback_font(Drw *drw, long codepoint)
+{
+	Fnt *font, *curfont;
+	unsigned int i;
+	FcCharSet *fccharset;
+	FcPattern *fcpattern;
+	FcPattern *match;
+	XftResult result;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, codepoint);
+
+	fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+	FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
+
+	FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+	FcDefaultSubstitute(fcpattern);
+	match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+
+	FcCharSetDestroy(fccharset);
+	FcPatternDestroy(fcpattern);
+
+	if (!match) return NULL;
+	font = xfont_create(drw, NULL, match);
+	if (!font || !XftCharExists(drw->dpy, font->xfont, codepoint) ||
+	    drw->nprimary == COVERFONTS) {
+		xfont_free(font);
+		return NULL;
+	}
+	if (drw->nfonts - drw->nprimary >= FALLBACKFONTS || drw->nfonts == COVERFONTS)
+		i = fallback_evict(drw);
+	else
+		i = drw->nfonts++;
+	for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
+		; /* NOP */
+	curfont->next = font;
+	drw->fontv[i] = font;
+	return font;
+}
+
+/* Returns the font drw_text draws codepoint with: the first one that has it,
+ * else a fallback, else the first font. Each codepoint is looked up at most
+ * once, including the ones no font on the system has.
+ */
+static Fnt *
+drw_charfont(Drw *drw, long codepoint)
+{
+	unsigned char *page, *cov;
+	unsigned int i;
+	Fnt *font;
+
+	if (codepoint < 0 || codepoint >= COVERPAGES << 8) return drw->fonts;
+	if (!(page = drw->cover[codepoint >> 8]))
+		page = drw->cover[codepoint >> 8] = ecalloc(256, 1);
+	cov = &page[codepoint & 0xff];
+	if (*cov == CoverNone) return drw->fonts;
+	if (*cov == CoverUnknown) {
+		for (i = 0; i < drw->nfonts; i++)
+			if (XftCharExists(drw->dpy, drw->fontv[i]->xfont, codepoint))
+				break;
+		if (i == drw->nfonts) {
+			if (!(font = fallback_font(drw, codepoint))) {
+				*cov = CoverNone;
+				return drw->fonts;
+			}
+			for (i = drw->nprimary; drw->fontv[i] != font; i++)
+				; /* NOP */
+		}
+		*cov = i + 1;
+	}
+	font = drw->fontv[*cov - 1];
+	if (*cov > drw->nprimary) font->used = ++drw->fonttick;
+	return font;
+}
+
+/* Looks up the font drw_text draws codepoint with and its advance. */
+static Chr *
+drw_glyph(Drw *drw, long codepoint)
+{
+	Chr *g;
+	Fnt *font;
+	FcChar32 ucs4 = codepoint;
+	XGlyphInfo ext;
+
+	if (codepoint >= 0 && codepoint < 128)
+		g = &drw->ascii[codepoint];
+	else
+		g = &drw->glyphs[codepoint & (GLYPHCACHE - 1)];
+	if (g->font && g->cp == codepoint) return g;
+
+	font = drw_charfont(drw, codepoint);
+	XftTextExtents32(drw->dpy, font->xfont, &ucs4, 1, &ext);
+	g->cp = codepoint;
+	g->font = font;
+	g->adv = ext.xOff;
+	return g;
+}
+
 Fnt *drw_fontset_create(Drw *drw, const char *fonts[], size_t fontcount)
 {
 	Fnt *cur, *ret = NULL;
@@ -277,7 +449,9 @@ Fnt *drw_fontset_create(Drw *drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
-	return (drw->fonts = ret);
+	drw->fonts = ret;
+	fontset_reset(drw);
+	return ret;
 }
 
 void drw_fontset_free(Fnt *font)
@@ -317,7 +491,41 @@ Clr *drw_scm_create(Drw *drw, char *clrnames[], size_t clrcount)
 
 void drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw) drw->fonts = set;
+	if (!drw) return;
+	drw->fonts = set;
+	fontset_reset(drw);
+}
+
+void drw_dumpstats(Drw *drw)
+{
+	size_t i, pages = 0;
+	unsigned long glyphmem = 0;
+	int max, n, bpp = 32;
+	XPixmapFormatValues *formats;
+
+	if (!drw) return;
+	if ((formats = XListPixmapFormats(drw->dpy, &n))) {
+		while (n--)
+			if (formats[n].depth == DefaultDepth(drw->dpy, drw->screen))
+				bpp = formats[n].bits_per_pixel;
+		XFree(formats);
+	}
+	fprintf(stderr, "drw: back buffer: %ux%u, %lu KiB\n", drw->w, drw->h,
+		(unsigned long)drw->w * drw->h * bpp / 8 / 1024);
+
+	for (i = 0; i < COVERPAGES; i++) pages += drw->cover[i] != NULL;
+	/* Xft keeps rendered glyphs per font up to this limit */
+	for (i = drw->nprimary; i < drw->nfonts; i++)
+		if (FcPatternGetInteger(drw->fontv[i]->xfont->pattern,
+					XFT_MAX_GLYPH_MEMORY, 0, &max) == FcResultMatch)
+			glyphmem += max;
+		else
+			glyphmem += 1024 * 1024;
+	fprintf(stderr, "drw: fallback fonts: %u/%d loaded, %lu evicted\n",
+		drw->nfonts - drw->nprimary, FALLBACKFONTS, drw->evictions);
+	fprintf(stderr, "drw: fallback glyph memory: up to %lu KiB\n", glyphmem / 1024);
+	fprintf(stderr, "drw: coverage map: %zu KiB\n",
+		(sizeof drw->cover + pages * 256) / 1024);
 }
 
 void drw_setscheme(Drw *drw, Clr *scm)
@@ -342,18 +550,12 @@ int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 {
 	char buf[1024];
 	int ty;
-	unsigned int ew;
-	XftDraw *d = NULL;
-	Fnt *usedfont, *curfont, *nextfont;
+	unsigned int ew, adv, dotw;
+	Fnt *usedfont, *curfont;
 	size_t i, len;
-	int utf8strlen, utf8charlen, render = x || y || w || h;
+	int utf8strlen, utf8charlen, trunc = 0, render = x || y || w || h;
 	long utf8codepoint = 0;
 	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
 
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts) return 0;
 
@@ -363,113 +565,67 @@ int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 		XSetForeground(drw->dpy, drw->gc,
 			       drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-				  DefaultVisual(drw->dpy, drw->screen),
-				  DefaultColormap(drw->dpy, drw->screen));
 		x += lpad;
 		w -= lpad;
 	}
 
-	usedfont = drw->fonts;
-	while (1) {
+	while (*text && !trunc) {
+		/* take the longest run of characters drawn with the same font */
 		utf8strlen = 0;
 		utf8str = text;
-		nextfont = NULL;
+		usedfont = NULL;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists ||
-					     XftCharExists(drw->dpy, curfont->xfont,
-							   utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
-
-			if (!charexists || nextfont)
+			curfont = drw_charfont(drw, utf8codepoint);
+			if (!usedfont)
+				usedfont = curfont;
+			else if (curfont != usedfont)
 				break;
-			else
-				charexists = 0;
+			utf8strlen += utf8charlen;
+			text += utf8charlen;
 		}
 
-		if (utf8strlen) {
-			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL);
-			/* shorten text if necessary */
-			for (len = MIN(utf8strlen, sizeof(buf) - 1); len && ew > w; len--)
-				drw_font_getexts(usedfont, utf8str, len, &ew, NULL);
-
-			if (len) {
-				memcpy(buf, utf8str, len);
-				buf[len] = '\0';
-				if (len < utf8strlen)
-					for (i = len; i && i > len - 3; buf[--i] = '.')
-						; /* NOP */
-
-				if (render) {
-					ty = y + (h - usedfont->h) / 2 +
-					     usedfont->xfont->ascent;
-					XftDrawStringUtf8(
-						d, &drw->scheme[invert ? ColBg : ColFg],
-						usedfont->xfont, x, ty, (XftChar8 *)buf,
-						len);
-				}
-				x += ew;
-				w -= ew;
-			}
+		/* every character of the run is drawn with usedfont, so the
+		 * glyph cache has its advance */
+		for (ew = 0, i = 0; i < utf8strlen; i += utf8charlen) {
+			utf8charlen = utf8decode(utf8str + i, &utf8codepoint, UTF_SIZ);
+			ew += drw_glyph(drw, utf8codepoint)->adv;
 		}
-
-		if (!*text) {
-			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
+		len = utf8strlen;
+		if (ew <= w && len < sizeof(buf)) {
+			memcpy(buf, utf8str, len);
 		} else {
-			/* Regardless of whether or not a fallback font is found, the
-             * character must be drawn. */
-			charexists = 1;
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
+			/* cut at the last character that leaves room for the ellipsis */
+			trunc = 1;
+			drw_font_getexts(usedfont, "...", 3, &dotw, NULL);
+			for (ew = 0, len = 0, i = 0; i < utf8strlen; i += utf8charlen) {
+				utf8charlen = utf8decode(utf8str + i, &utf8codepoint, UTF_SIZ);
+				adv = drw_glyph(drw, utf8codepoint)->adv;
+				if (ew + adv + dotw > w || i + utf8charlen > sizeof(buf) - 4)
+					break;
+				ew += adv;
+				len = i + utf8charlen;
 			}
-
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-			FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont,
-							      utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next;
-					     curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
+			if (dotw > w) {
+				len = 0;
+			} else {
+				memcpy(buf, utf8str, len);
+				memcpy(buf + len, "...", 3);
+				ew += dotw;
+				len += 3;
 			}
 		}
+		if (len) {
+			if (render) {
+				ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
+				XftDrawStringUtf8(drw->xftdraw,
+						  &drw->scheme[invert ? ColBg : ColFg],
+						  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
+			}
+			x += ew;
+			w -= ew;
+		}
 	}
-	if (d) XftDrawDestroy(d);
 
 	return x + (render ? w : 0);
 }
@@ -479,13 +635,43 @@ void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 	if (!drw) return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, 0, 0);
-	XSync(drw->dpy, False);
 }
 
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	TextWidth *tw, *lru = NULL;
+	const char *s;
+	unsigned int w = 0, hash = 2166136261u;
+	size_t len;
+	long cp;
+
 	if (!drw || !drw->fonts || !text) return 0;
-	return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	/* short labels are measured over and over, remember the last few */
+	for (s = text; *s && s - text < sizeof tw->text - 1; s++)
+		hash = (hash ^ *s) * 16777619u;
+	if (!*s) {
+		for (tw = drw->widths; tw < drw->widths + WIDTHCACHE; tw++) {
+			if (tw->used && tw->hash == hash && !strcmp(tw->text, text)) {
+				tw->used = ++drw->widthtick;
+				return tw->w;
+			}
+			if (!lru || tw->used < lru->used) lru = tw;
+		}
+	}
+
+	for (s = text; *s; s += len) {
+		len = utf8decode(s, &cp, UTF_SIZ);
+		w += drw_glyph(drw, cp)->adv;
+	}
+
+	if (lru) {
+		strcpy(lru->text, text);
+		lru->hash = hash;
+		lru->w = w;
+		lru->used = ++drw->widthtick;
+	}
+	return w;
 }
 
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w,
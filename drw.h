@@ -9,12 +9,36 @@ typedef struct Fnt {
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
+	unsigned long used; /* last use of a fallback font */
 	struct Fnt *next;
 } Fnt;
 
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
 typedef XftColor Clr;
 
+/* font a codepoint is drawn with and its advance, font is NULL when unset */
+typedef struct {
+	long cp;
+	Fnt *font;
+	unsigned int adv;
+} Chr;
+
+/* recently measured strings, e.g. tag names and layout symbols */
+typedef struct {
+	char text[48];
+	unsigned int hash, w;
+	unsigned long used;
+} TextWidth;
+
+#define GLYPHCACHE 1024 /* power of two, direct-mapped */
+#define WIDTHCACHE 32
+#define COVERPAGES (0x110000 >> 8) /* 256 codepoints per page */
+#define COVERFONTS 254
+#define FALLBACKFONTS 16 /* fallback fonts kept loaded, least recently used go first */
+
+/* coverage map values besides index + 1 into Drw.fontv */
+enum { CoverUnknown = 0, CoverNone = 255 };
+
 typedef struct {
 	unsigned int w, h;
 	Display *dpy;
@@ -22,9 +46,18 @@ typedef struct {
 	Window root;
 	Drawable drawable;
 	Picture picture;
+	XftDraw *xftdraw; /* follows drawable */
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	Fnt *fontv[COVERFONTS]; /* the user's fonts, then fallbacks */
+	unsigned int nfonts, nprimary;
+	unsigned long fonttick, evictions;
+	unsigned char *cover[COVERPAGES]; /* allocated on first use */
+	Chr ascii[128];
+	Chr glyphs[GLYPHCACHE];
+	TextWidth widths[WIDTHCACHE];
+	unsigned long widthtick;
 } Drw;
 
 /* Drawable abstraction */
@@ -57,6 +90,9 @@ void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad,
 	     const char *text, int invert);
 
+/* Debugging */
+void drw_dumpstats(Drw *drw);
+
 /* Map functions */
 void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h);
 
@@ -0,0 +1,473 @@
+/* Unix socket control interface, the protocol is described in README.md */
+
+/* Internals */
+#define IPCRING 64 /* events queued per subscriber before the oldest is dropped */
+#define IPCEVENTLEN 512
+
+enum { EvFocus, EvTags, EvLayout, EvManage, EvUnmanage, EvTitle, EvLast };
+
+typedef struct IpcConn IpcConn;
+struct IpcConn {
+	int fd;
+	int eof;
+	int dead; /* to be closed by ipcread(), never from under a caller */
+	char in[1024];
+	size_t inlen;
+	char *out;
+	size_t outlen, outsize;
+	unsigned int subs; /* 1 << Ev* the connection subscribed to */
+	char (*ring)[IPCEVENTLEN];
+	unsigned int head, count, dropped;
+	size_t ringoff; /* bytes of the head event already written */
+	IpcConn *next;
+};
+
+enum { IpcNone, IpcInt, IpcUint, IpcFloat, IpcLayout, IpcScratch, IpcShell };
+typedef struct {
+	const char *name;
+	void (*func)(const Arg *);
+	int type;
+} IpcCommand;
+
+typedef struct {
+	const char *name;
+	void (*func)(IpcConn *c);
+} IpcQuery;
+
+void ipcaccept(int fd, short revents);
+void ipccleanup(void);
+void ipcclose(IpcConn *c);
+void ipcevent(int ev, const char *fmt, ...);
+void ipcexec(IpcConn *c, char *line);
+void ipcflush(IpcConn *c);
+void ipcinit(void);
+void ipcprintf(IpcConn *c, const char *fmt, ...);
+void ipcread(int fd, short revents);
+void ipcsubscribe(IpcConn *c, char *arg);
+void qclients(IpcConn *c);
+void qcommands(IpcConn *c);
+void qlayouts(IpcConn *c);
+void qmonitors(IpcConn *c);
+void qtags(IpcConn *c);
+
+static const IpcCommand ipccommands[] = {
+	/* name            function          argument */
+	{ "cyclelayout", cyclelayout, IpcInt },
+	{ "defaultgaps", defaultgaps, IpcNone },
+	{ "dumpstats", dumpstats, IpcNone },
+	{ "focusmon", focusmon, IpcInt },
+	{ "focusstack", focusstack, IpcInt },
+	{ "hide", hide, IpcInt },
+	{ "incnmaster", incnmaster, IpcInt },
+	{ "incrgaps", incrgaps, IpcInt },
+	{ "killclient", killclient, IpcNone },
+	{ "pushstack", pushstack, IpcInt },
+	{ "quit", quit, IpcInt },
+	{ "setlayout", setlayout, IpcLayout },
+	{ "setmfact", setmfact, IpcFloat },
+	{ "shifttag", shifttag, IpcInt },
+	{ "shiftview", shiftview, IpcInt },
+#ifndef __OpenBSD__
+	{ "sigdwmblocks", sigdwmblocks, IpcInt },
+#endif
+	{ "spawn", spawn, IpcShell },
+	{ "swaptags", swaptags, IpcUint },
+	{ "tag", tag, IpcUint },
+	{ "tagmon", tagmon, IpcInt },
+	{ "togglebar", togglebar, IpcNone },
+	{ "togglefloating", togglefloating, IpcNone },
+	{ "togglefullscr", togglefullscr, IpcNone },
+	{ "togglegaps", togglegaps, IpcNone },
+	{ "togglelazy", togglelazy, IpcNone },
+	{ "togglescratch", togglescratch, IpcScratch },
+	{ "togglesticky", togglesticky, IpcNone },
+	{ "toggletag", toggletag, IpcUint },
+	{ "toggleview", toggleview, IpcUint },
+	{ "view", view, IpcUint },
+	{ "zoom", zoom, IpcNone },
+};
+
+static const IpcQuery ipcqueries[] = {
+	{ "clients", qclients },
+	{ "commands", qcommands },
+	{ "layouts", qlayouts },
+	{ "monitors", qmonitors },
+	{ "tags", qtags },
+};
+
+static const char *ipcevents[] = {
+	[EvFocus] = "focus",   [EvTags] = "tags",	  [EvLayout] = "layout",
+	[EvManage] = "manage", [EvUnmanage] = "unmanage", [EvTitle] = "title",
+};
+
+static struct sockaddr_un ipcaddr = { .sun_family = AF_UNIX };
+static int ipcfd = -1;
+static IpcConn *ipcconns;
+static unsigned int ipcsubs; /* union of all subscriptions */
+
+void ipcaccept(int fd, short revents)
+{
+	int cfd;
+	IpcConn *c;
+
+	while ((cfd = accept(fd, NULL, NULL)) != -1) {
+		fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+		fcntl(cfd, F_SETFD, FD_CLOEXEC);
+		if (nwatches == MAXWATCH) {
+			close(cfd);
+			continue;
+		}
+		c = ecalloc(1, sizeof(IpcConn));
+		c->fd = cfd;
+		c->next = ipcconns;
+		ipcconns = c;
+		addwatch(cfd, POLLIN, ipcread);
+	}
+}
+
+void ipccleanup(void)
+{
+	/* best effort for replies still queued, e.g. to the quit command */
+	for (; ipcconns; ipcclose(ipcconns))
+		if (ipcconns->outlen)
+			send(ipcconns->fd, ipcconns->out, ipcconns->outlen, MSG_NOSIGNAL);
+	if (ipcfd == -1) return;
+	delwatch(ipcfd);
+	close(ipcfd);
+	unlink(ipcaddr.sun_path);
+	ipcfd = -1;
+}
+
+void ipcclose(IpcConn *c)
+{
+	IpcConn **tc;
+
+	for (tc = &ipcconns; *tc && *tc != c; tc = &(*tc)->next)
+		;
+	*tc = c->next;
+	delwatch(c->fd);
+	close(c->fd);
+	free(c->out);
+	free(c->ring);
+	free(c);
+	for (ipcsubs = 0, c = ipcconns; c; c = c->next) ipcsubs |= c->subs;
+}
+
+void ipcevent(int ev, const char *fmt, ...)
+{
+	char line[IPCEVENTLEN];
+	va_list ap;
+	int n;
+	IpcConn *c, *next;
+
+	if (!(ipcsubs & 1 << ev)) return;
+	n = snprintf(line, sizeof line, "%s ", ipcevents[ev]);
+	va_start(ap, fmt);
+	vsnprintf(line + n, sizeof line - n, fmt, ap);
+	va_end(ap);
+	line[sizeof line - 2] = '\n'; /* keep truncated events on one line */
+	line[sizeof line - 1] = '\0';
+
+	for (c = ipcconns; c; c = next) {
+		next = c->next;
+		if (c->dead || !(c->subs & 1 << ev)) continue;
+		if (c->count == IPCRING) {
+			/* drop the oldest event, unless it is half written */
+			if (c->ringoff) {
+				ipcprintf(c, "%s", c->ring[c->head] + c->ringoff);
+				c->ringoff = 0;
+			}
+			c->head = (c->head + 1) % IPCRING;
+			c->count--;
+			c->dropped++;
+		}
+		strcpy(c->ring[(c->head + c->count++) % IPCRING], line);
+		ipcflush(c);
+	}
+}
+
+void ipcexec(IpcConn *c, char *line)
+{
+	char *cmd, *arg, *end = NULL;
+	const char *shcmd[] = { "/bin/sh", "-c", NULL, NULL };
+	unsigned int i;
+	Arg a = { 0 };
+
+	cmd = line + strspn(line, " \t");
+	arg = cmd + strcspn(cmd, " \t");
+	if (*arg) *arg++ = '\0';
+	arg += strspn(arg, " \t");
+	if (!*cmd) return;
+
+	if (!strcmp(cmd, "subscribe")) {
+		ipcsubscribe(c, arg);
+		return;
+	}
+	for (i = 0; i < LENGTH(ipcqueries); i++)
+		if (!strcmp(cmd, ipcqueries[i].name)) {
+			flushdirty(); /* report the geometry the clients will end up with */
+			ipcprintf(c, "ok\n");
+			ipcqueries[i].func(c);
+			ipcprintf(c, "\n");
+			return;
+		}
+	for (i = 0; i < LENGTH(ipccommands) && strcmp(cmd, ipccommands[i].name); i++)
+		;
+	if (i == LENGTH(ipccommands)) {
+		ipcprintf(c, "error unknown command %s\n\n", cmd);
+		return;
+	}
+
+	errno = 0;
+	switch (ipccommands[i].type) {
+	case IpcInt:
+		a.i = strtol(arg, &end, 0);
+		break;
+	case IpcUint:
+		a.ui = strtoul(arg, &end, 0);
+		break;
+	case IpcFloat:
+		a.f = strtof(arg, &end);
+		break;
+	case IpcLayout:
+		if (!*arg) break;
+		a.ui = strtoul(arg, &end, 0);
+		if (a.ui >= LENGTH(layouts) - 1)
+			errno = ERANGE;
+		else
+			a.v = &layouts[a.ui];
+		break;
+	case IpcScratch:
+		a.ui = strtoul(arg, &end, 0);
+		if (a.ui >= LENGTH(scratchpads)) errno = ERANGE;
+		break;
+	case IpcShell:
+		if (!*arg) errno = EINVAL;
+		shcmd[2] = arg;
+		a.v = shcmd;
+		break;
+	}
+	if (ipccommands[i].type != IpcNone && ipccommands[i].type != IpcShell &&
+	    *arg && (*end || end == arg))
+		errno = EINVAL;
+	if (errno) {
+		ipcprintf(c, "error bad argument %s\n\n", arg);
+		return;
+	}
+	ipccommands[i].func(&a);
+	ipcprintf(c, "ok\n\n");
+}
+
+void ipcflush(IpcConn *c)
+{
+	ssize_t n = 0;
+	size_t len;
+	char *line;
+
+	/* replies first, then queued events, never blocking */
+	while (c->outlen && (n = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL)) > 0) {
+		memmove(c->out, c->out + n, c->outlen - n);
+		c->outlen -= n;
+	}
+	if (c->dropped && !c->outlen && n >= 0) {
+		ipcprintf(c, "dropped %u\n", c->dropped);
+		c->dropped = 0;
+		ipcflush(c);
+		return;
+	}
+	while (!c->outlen && c->count) {
+		line = c->ring[c->head] + c->ringoff;
+		len = strlen(line);
+		if ((n = send(c->fd, line, len, MSG_NOSIGNAL)) <= 0) break;
+		if ((size_t)n < len) {
+			c->ringoff += n;
+			continue;
+		}
+		c->ringoff = 0;
+		c->head = (c->head + 1) % IPCRING;
+		c->count--;
+	}
+	if ((n < 0 && errno != EAGAIN && errno != EINTR) ||
+	    (!c->outlen && !c->count && c->eof && !c->subs))
+		c->dead = 1;
+	/* a dead connection polls writable at once, so ipcread() gets to close it */
+	if (c->dead)
+		setwatch(c->fd, POLLOUT);
+	else
+		setwatch(c->fd, (c->eof ? 0 : POLLIN) |
+					(c->outlen || c->count ? POLLOUT : 0));
+}
+
+void ipcinit(void)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR"), *ds = DisplayString(dpy);
+	char *path = ipcaddr.sun_path;
+	int display = 0;
+
+	/* one socket per display, so nested sessions do not collide */
+	if ((ds = strrchr(ds, ':'))) display = atoi(ds + 1);
+	if (dir && *dir)
+		snprintf(path, sizeof ipcaddr.sun_path, "%s/pdwm-%d.sock", dir, display);
+	else
+		snprintf(path, sizeof ipcaddr.sun_path, "/tmp/pdwm-%u-%d.sock",
+			 (unsigned)getuid(), display);
+
+	if ((ipcfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("pdwm: ipc socket");
+		return;
+	}
+	fcntl(ipcfd, F_SETFL, fcntl(ipcfd, F_GETFL) | O_NONBLOCK);
+	fcntl(ipcfd, F_SETFD, FD_CLOEXEC);
+	unlink(path);
+	if (bind(ipcfd, (struct sockaddr *)&ipcaddr, sizeof ipcaddr) == -1 ||
+	    chmod(path, 0600) == -1 || listen(ipcfd, 8) == -1) {
+		perror("pdwm: ipc socket");
+		close(ipcfd);
+		ipcfd = -1;
+		return;
+	}
+	addwatch(ipcfd, POLLIN, ipcaccept);
+	setenv("PDWM_SOCKET", path, 1);
+}
+
+void ipcprintf(IpcConn *c, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0) return;
+	if (c->outlen + n + 1 > c->outsize) {
+		c->outsize = MAX(c->outsize * 2, c->outlen + n + 1);
+		if (!(c->out = realloc(c->out, c->outsize))) die("pdwm: realloc:");
+	}
+	va_start(ap, fmt);
+	vsnprintf(c->out + c->outlen, n + 1, fmt, ap);
+	va_end(ap);
+	c->outlen += n;
+}
+
+void ipcread(int fd, short revents)
+{
+	IpcConn *c;
+	char *line, *nl;
+	ssize_t n;
+
+	for (c = ipcconns; c && c->fd != fd; c = c->next)
+		;
+	if (!c) return;
+	if (c->dead || revents & (POLLERR | POLLNVAL) || (revents & POLLHUP && c->eof)) {
+		ipcclose(c);
+		return;
+	}
+	if (revents & (POLLIN | POLLHUP)) {
+		n = read(fd, c->in + c->inlen, sizeof c->in - c->inlen);
+		if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+			c->eof = 1;
+		else if (n > 0)
+			c->inlen += n;
+
+		/* every complete line is one request */
+		line = c->in;
+		while (!c->dead && (nl = memchr(line, '\n', c->inlen - (line - c->in)))) {
+			*nl = '\0';
+			ipcexec(c, line);
+			line = nl + 1;
+		}
+		c->inlen -= line - c->in;
+		memmove(c->in, line, c->inlen);
+		if (c->inlen == sizeof c->in) {
+			ipcprintf(c, "error request too long\n\n");
+			c->eof = 1;
+		} else if (c->eof && c->inlen && !c->dead) {
+			/* the last request may lack its newline */
+			c->in[c->inlen] = '\0';
+			c->inlen = 0;
+			ipcexec(c, c->in);
+		}
+	}
+	ipcflush(c);
+	if (c->dead) ipcclose(c);
+}
+
+void ipcsubscribe(IpcConn *c, char *arg)
+{
+	char *name;
+	unsigned int i, subs = 0;
+
+	for (name = strtok(arg, " \t"); name; name = strtok(NULL, " \t")) {
+		for (i = 0; i < EvLast && strcmp(name, ipcevents[i]); i++)
+			;
+		if (i == EvLast) {
+			ipcprintf(c, "error unknown event %s\n\n", name);
+			return;
+		}
+		subs |= 1 << i;
+	}
+	if (!c->ring) c->ring = ecalloc(IPCRING, IPCEVENTLEN);
+	/* no names means every event */
+	c->subs = subs ? subs : (1 << EvLast) - 1;
+	ipcsubs |= c->subs;
+	ipcprintf(c, "ok\n\n");
+}
+
+void qclients(IpcConn *c)
+{
+	Monitor *m;
+	Client *cl;
+
+	for (m = mons; m; m = m->next)
+		for (cl = m->clients; cl; cl = cl->next)
+			ipcprintf(c,
+				  "win=0x%lx mon=%d tags=%u x=%d y=%d w=%d h=%d floating=%d "
+				  "fullscreen=%d urgent=%d hidden=%d sticky=%d focused=%d "
+				  "pid=%d name=%s\n",
+				  cl->win, m->num, cl->tags, cl->x, cl->y, cl->w, cl->h,
+				  cl->isfloating, cl->isfullscreen, cl->isurgent, HIDDEN(cl),
+				  cl->issticky, cl == selmon->sel, (int)cl->pid, cl->name);
+}
+
+void qcommands(IpcConn *c)
+{
+	unsigned int i;
+
+	ipcprintf(c, "subscribe\n");
+	for (i = 0; i < LENGTH(ipcqueries); i++) ipcprintf(c, "%s\n", ipcqueries[i].name);
+	for (i = 0; i < LENGTH(ipccommands); i++) ipcprintf(c, "%s\n", ipccommands[i].name);
+}
+
+void qlayouts(IpcConn *c)
+{
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(layouts) - 1; i++)
+		ipcprintf(c, "index=%u current=%d symbol=%s\n", i,
+			  &layouts[i] == selmon->lt[selmon->sellt], layouts[i].symbol);
+}
+
+void qmonitors(IpcConn *c)
+{
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		ipcprintf(c,
+			  "num=%d x=%d y=%d w=%d h=%d selected=%d tags=%u mfact=%.2f "
+			  "nmaster=%d showbar=%d layout=%s\n",
+			  m->num, m->mx, m->my, m->mw, m->mh, m == selmon,
+			  m->tagset[m->seltags], m->mfact, m->nmaster, m->showbar,
+			  m->ltsymbol);
+}
+
+void qtags(IpcConn *c)
+{
+	unsigned int i;
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < LENGTH(tags) - 1; i++)
+			ipcprintf(c, "mon=%d tag=%u selected=%d occupied=%d urgent=%d name=%s\n",
+				  m->num, i, !!(m->tagset[m->seltags] & 1 << i),
+				  !!(m->occ & 1 << i), !!(m->urg & 1 << i), tags[i]);
+}
@@ -27,16 +27,21 @@
 #include <X11/cursorfont.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <locale.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
@@ -44,6 +49,9 @@
 #include <X11/Xft/Xft.h>
 #include <X11/Xlib-xcb.h>
 #include <xcb/res.h>
+#ifdef PRESENT
+#include <xcb/present.h>
+#endif /* PRESENT */
 
 #include "config.h"
 #include "drw.h"
@@ -63,7 +71,7 @@
 	 MAX(0, MIN((y) + (h), (m)->wy + (m)->wh) - MAX((y), (m)->wy)))
 #define ISINC(X) ((X) > 1000 && (X) < 3000)
 #define ISVISIBLE(C) ((C->tags & C->mon->tagset[C->mon->seltags]) || C->issticky)
-#define HIDDEN(C) ((getstate(C->win) == IconicState))
+#define HIDDEN(C) ((C)->ishidden)
 #define PREVSEL 3000
 #define LENGTH(X) (sizeof X / sizeof X[0])
 #define MOUSEMASK (BUTTONMASK | PointerMotionMask)
@@ -103,12 +111,77 @@
 #define XEMBED_EMBEDDED_VERSION (VERSION_MAJOR << 16) | VERSION_MINOR
 
 static Window allbarwin[2];
+static BarSeg titleseg, statusseg; /* shown in allbarwin[0] and allbarwin[1] */
+enum { HitLogo = ClkLast, HitConfig }; /* bar areas not handled through buttons[] */
 static struct Stray {
 	Window win;
 	Client *icons;
 } Systray;
 static struct Stray *systray = &Systray;
 
+/* window index, maps managed, swallowed and systray windows to their client */
+enum { WinClient, WinSwallowed, WinSystray };
+typedef struct {
+	Window win;
+	Client *c;
+	int kind;
+} WinEntry;
+static WinEntry *wintab;
+static unsigned int wintabsize, wintablen;
+
+/* properties requested up front when a window is adopted */
+enum {
+	PropIcon,
+	PropNetName,
+	PropName,
+	PropSizeHints,
+	PropWMHints,
+	PropTransient,
+	PropClass,
+	PropDesktop,
+	PropState,
+	PropType,
+	PropWMState,
+	PropLast
+};
+typedef struct {
+	xcb_res_query_client_ids_cookie_t pid;
+	xcb_get_property_cookie_t prop[PropLast];
+} Prefetch;
+typedef struct {
+	xcb_get_window_attributes_cookie_t attr;
+	xcb_get_geometry_cookie_t geom;
+	xcb_get_property_cookie_t trans, state;
+} ScanQuery;
+
+/* file descriptors the main loop polls next to the X connection */
+#define MAXWATCH 32
+typedef struct {
+	int fd;
+	short events;
+	void (*func)(int fd, short revents);
+} Watch;
+static Watch watches[MAXWATCH];
+static int nwatches;
+static int sigpipe[2] = { -1, -1 };
+
+/* one-shot timers, due is a CLOCK_MONOTONIC time in ms, 0 when disarmed */
+enum { TimerDrag, TimerLast };
+typedef struct {
+	long long due;
+	void (*func)(void);
+} Timer;
+
+/* pointer grab driven by the main loop, kind is CurMove, CurResize or CurNormal */
+static struct {
+	int kind;
+	Client *c;
+	int x, y, ocx, ocy;
+	int pending;
+	XMotionEvent motion;
+	Time lasttime;
+} drag = { CurNormal };
+
 const Rule *rules;
 extern const Rule *get_rules();
 
@@ -135,11 +208,27 @@ static const char autostartsh[] = "autostart.sh";
 static const char broken[] = "broken";
 static const char pdwmdir[] = "phyos/pdwm";
 static const char localshare[] = ".config";
-static char *sb_arr[10]; /* Array that holds name of pngs */
-static int sb_tw;
 static char stext[256];
 static char rawstext[256];
 static int dwmblockssig;
+
+/* stext split at '|' into items of an optional icon and a text, laid out
+ * from the left edge of the status area by parsestatus() */
+#define MAXSTATUS 32
+typedef struct {
+	int icon; /* icon index, -1 for none */
+	int off; /* text in status.text */
+	int scheme;
+	int x, w; /* whole item, separator included */
+	int iconx, textx, textw, sepx;
+	char sig; /* dwmblocks signal of the block the item starts in */
+} StatusItem;
+static struct {
+	unsigned int hash; /* of rawstext */
+	int n, w;
+	char text[sizeof stext]; /* stext with '|' replaced by NUL */
+	StatusItem items[MAXSTATUS];
+} status;
 pid_t dwmblockspid = 0;
 static int screen;
 static int sw, sh; /* X display screen geometry width, height */
@@ -150,6 +239,11 @@ static unsigned int numlockmask = 0;
 static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast];
 static int restart = 0;
 static int running = 1;
+static int batching = 0; /* handling a burst of events, see flushdirty() */
+static unsigned long redrawssaved = 0;
+static unsigned long segsreused = 0;
+static unsigned long configsskipped = 0;
+static unsigned long layoutsreused = 0;
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
@@ -157,46 +251,67 @@ static Drw *drw;
 static Window root, wmcheckwin;
 
 static xcb_connection_t *xcon;
+#ifdef PRESENT
+static int present; /* bar updates go through the Present extension */
+static uint32_t presentserial;
+#endif /* PRESENT */
 
 /* function declarations */
+static void addwatch(int fd, short events, void (*func)(int fd, short revents));
 static void autostart(void);
+static int addhit(Monitor *m, int x, int w, unsigned int click, unsigned int arg);
 static void applyrules(Client *c);
+static void rulesreply(Client *c, xcb_get_property_cookie_t class,
+		       xcb_get_property_cookie_t desktop);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
 static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
+static void attachafter(Client *c, Client *p);
 static void attachstack(Client *c);
 static void buttonpress(XEvent *e);
+static void buttonrelease(XEvent *e);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
+static void delwatch(int fd);
 static void clientmessage(XEvent *e);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
-static void copyvalidchars(char *text, char *rawtext);
 static Monitor *createmon(void);
 void cyclelayout(const Arg *arg);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
+static void dispatch(XEvent *ev);
+static void dragmotion(XMotionEvent *ev);
+static void dragtimeout(void);
 static void drawbar(Monitor *m);
 static void drawbars(void);
+void dumpstats(const Arg *arg);
+static void enddrag(int cancel);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
 static void freeicon(Client *c);
+static BarHit *findhit(Monitor *m, int x);
+static void flushdirty(void);
 void focus(Client *c);
 static void focusin(XEvent *e);
 void focusmon(const Arg *arg);
 void focusstack(const Arg *arg);
+static void forgetlayouts(Monitor *m);
 void hide(const Arg *arg);
 static void hidewin(Client *c);
-static Picture geticonprop(Window w, unsigned int *icw, unsigned int *ich);
+static Picture geticonprop(xcb_get_property_cookie_t ck, unsigned int *icw,
+			   unsigned int *ich);
 static Atom getatomprop(Client *c, Atom prop);
+static xcb_get_property_cookie_t getprop(Window w, Atom prop, Atom type, uint32_t len);
 static int getrootptr(int *x, int *y);
 static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
+static void discardprefetch(Prefetch *pf);
 void swaptags(const Arg *arg);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
@@ -204,32 +319,43 @@ void layoutmenu(const Arg *arg);
 void incnmaster(const Arg *arg);
 static void keypress(XEvent *e);
 void killclient(const Arg *arg);
-static void manage(Window w, XWindowAttributes *wa);
+static void manage(Window w, XWindowAttributes *wa, Prefetch *pf);
+static void markurgent(Client *c, int urg);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
+static void markdirty(Monitor *m, unsigned int bits);
 void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 void movemouse(const Arg *arg);
 static Client *nexttiled(Client *c);
+static long long now(void);
+static void parsestatus(void);
 static void pop(Client *);
-static int processrawtext(char *text);
+static void prefetch(Window w, Prefetch *pf);
+static xcb_get_property_reply_t *propreply(xcb_get_property_cookie_t ck);
 static void propertynotify(XEvent *e);
 void pushstack(const Arg *arg);
 static void quit(const Arg *arg);
 static Monitor *recttomon(int x, int y, int w, int h);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
+static void resizebarbuf(void);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 void resizemouse(const Arg *arg);
 static void restack(Monitor *m);
 static void run(void);
+static void runtimers(void);
 static void runautostart(void);
 static void scan(void);
+static int segcached(BarSeg *seg, unsigned int h);
+static unsigned int seghash(unsigned int h, const void *p, size_t n);
+static void segstore(BarSeg *seg, Window win, int x, unsigned int w);
 static int sendevent(Window win, Atom proto, int m, long d0, long d1, long d2, long d3,
 		     long d4);
 static void sendmon(Client *c, Monitor *m);
 static void setclientstate(Client *c, long state);
 static void setclienttagprop(Client *c);
 void setfocus(Client *c);
+static void settags(Client *c, unsigned int tags);
 static void setfullscreen(Client *c, int fullscreen);
 void setlayout(const Arg *arg);
 void setmfact(const Arg *arg);
@@ -237,16 +363,22 @@ static void setup(void);
 static void seturgent(Client *c, int urg);
 static void showhide(Client *c);
 static void showwin(Client *c);
-static void sigchld(int unused);
+static void sizehintsreply(Client *c, xcb_get_property_cookie_t ck);
 #ifndef __OpenBSD__
 int getdwmblockspid();
 void sigdwmblocks(const Arg *arg);
 #endif
-static void sighup(int unused);
-static void sigterm(int unused);
+static void settimer(int id, int ms);
+static void setwatch(int fd, short events);
+static void sigread(int fd, short revents);
+static void sigwake(int sig);
 void spawn(const Arg *arg);
 static int stackpos(const Arg *arg);
+static int textreply(xcb_get_property_cookie_t ck, char *text, unsigned int size);
+static void titlereply(Client *c, xcb_get_property_cookie_t netname,
+		       xcb_get_property_cookie_t name);
 void tag(const Arg *arg);
+static void tagcount(Client *c, int n);
 void tagmon(const Arg *arg);
 void togglebar(const Arg *arg);
 void togglefloating(const Arg *arg);
@@ -259,19 +391,28 @@ static void unfocus(Client *c, int setfocus);
 static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void updatebarpos(Monitor *m);
+static void waitevents(int block);
 static void updatebars(void);
 static void updatecurrentdesktop(Monitor *m);
 static void updateclientlist(void);
 static int updategeom(void);
 static void updateicon(Client *c);
+static void iconreply(Client *c, xcb_get_property_cookie_t ck);
 static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
 static void updatestatus(void);
 static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
+static uint32_t valuereply(xcb_get_property_cookie_t ck);
 void view(const Arg *arg);
+static Client *visible(Monitor *m);
 static Client *wintoclient(Window w);
+static void windowtypereply(Client *c, xcb_get_property_cookie_t state,
+			    xcb_get_property_cookie_t type);
+static void winindex(Window w, Client *c, int kind);
+static Client *winlookup(Window w, int kind);
+static void winunindex(Window w);
 static Monitor *wintomon(Window w);
 static void setsticky(Client *c, int sticky);
 static int xerror(Display *dpy, XErrorEvent *ee);
@@ -283,10 +424,13 @@ static pid_t getparentprocess(pid_t p);
 static int isdescprocess(pid_t p, pid_t c);
 static Client *swallowingclient(Window w);
 static Client *termforwin(const Client *c);
-static pid_t winpid(Window w);
+static xcb_res_query_client_ids_cookie_t pidquery(Window w);
+static pid_t pidreply(xcb_res_query_client_ids_cookie_t ck);
+static void wmhintsreply(Client *c, xcb_get_property_cookie_t ck);
 void defaultgaps(const Arg *arg);
 void incrgaps(const Arg *arg);
 void togglegaps(const Arg *arg);
+void togglelazy(const Arg *arg);
 void bstack(Monitor *m);
 void centeredmaster(Monitor *m);
 void centeredfloatingmaster(Monitor *m);
@@ -295,7 +439,7 @@ void dwindle(Monitor *m);
 void fibonacci(Monitor *m, int s);
 void spiral(Monitor *m);
 void tile(Monitor *);
-void getgaps(Monitor *m, int *oh, int *ov, int *ih, int *iv, unsigned int *nc);
+void getgaps(Monitor *m, unsigned int n, int *oh, int *ov, int *ih, int *iv);
 void setgaps(int oh, int ov, int ih, int iv);
 void shifttag(const Arg *arg);
 void shiftview(const Arg *arg);
@@ -311,6 +455,7 @@ static Client *wintosystrayicon(Window w);
 
 static Monitor *mons, *selmon;
 #include "vanitygaps.c" /* Needs selmon variable */
+#include "ipc.c"
 
 static const Key defkeys[] = { STACKKEYS(Mod4Mask, focus) STACKKEYS(
 	Mod4Mask | ShiftMask, push) TAGKEYS(XK_1, 0) TAGKEYS(XK_2, 1) TAGKEYS(XK_3, 2)
@@ -334,6 +479,7 @@ struct NumTags {
 };
 
 static void (*handler[])(XEvent *) = { [ButtonPress] = buttonpress,
+				       [ButtonRelease] = buttonrelease,
 				       [ClientMessage] = clientmessage,
 				       [ConfigureRequest] = configurerequest,
 				       [ConfigureNotify] = configurenotify,
@@ -348,28 +494,61 @@ static void (*handler[])(XEvent *) = { [ButtonPress] = buttonpress,
 				       [PropertyNotify] = propertynotify,
 				       [ResizeRequest] = resizerequest,
 				       [UnmapNotify] = unmapnotify };
+static Timer timers[TimerLast] = { [TimerDrag] = { 0, dragtimeout } };
 
 /* function implementations */
+void addwatch(int fd, short events, void (*func)(int fd, short revents))
+{
+	if (nwatches == MAXWATCH) die("pdwm: too many watched descriptors");
+	watches[nwatches].fd = fd;
+	watches[nwatches].events = events;
+	watches[nwatches++].func = func;
+}
+
 void autostart(void)
 {
 	system("killall -q dwmblocks; dwmblocks &");
 }
 
+/* Appends the bar area [x, x + w) to m->hits, returns where the next starts. */
+int addhit(Monitor *m, int x, int w, unsigned int click, unsigned int arg)
+{
+	if (m->nhits < MAXHITS)
+		m->hits[m->nhits++] = (BarHit){ x, x + w, click, arg };
+	return x + w;
+}
+
 void applyrules(Client *c)
 {
-	const char *class, *instance;
+	rulesreply(c, getprop(c->win, XA_WM_CLASS, XA_STRING, UINT32_MAX),
+		   getprop(c->win, netatom[NetWMDesktop], XA_CARDINAL, 2));
+}
+
+void rulesreply(Client *c, xcb_get_property_cookie_t classck,
+		xcb_get_property_cookie_t desktopck)
+{
+	const char *class = broken, *instance = broken;
+	char ch[512];
 	unsigned int i;
+	int len;
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
+	xcb_get_property_reply_t *reply;
 
 	/* rule matching */
 	c->iscentered = c->iscentered ? 1 : 0;
 	c->isfloating = c->isfloating ? 1 : 0;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	class = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name ? ch.res_name : broken;
+	/* WM_CLASS holds the instance and class names, each NUL terminated */
+	if ((reply = propreply(classck)) && reply->format == 8 &&
+	    (len = xcb_get_property_value_length(reply)) > 0) {
+		len = MIN(len, sizeof ch - 1);
+		memcpy(ch, xcb_get_property_value(reply), len);
+		ch[len] = '\0';
+		instance = ch;
+		class = ch + MIN(strlen(ch) + 1, len);
+	}
+	free(reply);
 
 	if (strstr(class, "Steam") || strstr(class, "steam_app_")) c->issteam = 1;
 
@@ -399,31 +578,21 @@ void applyrules(Client *c)
 			if (m) c->mon = m;
 		}
 	}
-	if (ch.res_class) XFree(ch.res_class);
-	if (ch.res_name) XFree(ch.res_name);
 
-	{
-		int format;
-		unsigned long *data, n, extra;
-		Monitor *m;
-		Atom atom;
+	if ((reply = propreply(desktopck)) && reply->format == 32 &&
+	    xcb_get_property_value_length(reply) == 2 * 4) {
+		uint32_t *data = xcb_get_property_value(reply);
 
-		if (XGetWindowProperty(dpy, c->win, netatom[NetWMDesktop], 0L, 2L, False,
-				       XA_CARDINAL, &atom, &format, &n, &extra,
-				       (unsigned char **)&data) == Success &&
-		    n == 2) {
+		if (!c->tags) c->tags = data[0];
 
-			if (!c->tags) c->tags = *data;
-
-			for (m = mons; m; m = m->next) {
-				if (m->num == *(data + 1)) {
-					c->mon = m;
-					break;
-				}
+		for (m = mons; m; m = m->next) {
+			if (m->num == data[1]) {
+				c->mon = m;
+				break;
 			}
 		}
-		if (n > 0) XFree(data);
 	}
+	free(reply);
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK :
 				      (c->mon->tagset[c->mon->seltags] & ~SPTAGMASK);
 }
@@ -481,6 +650,14 @@ int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 
 void arrange(Monitor *m)
 {
+	if (batching) {
+		if (m) {
+			updatecurrentdesktop(m);
+			markdirty(m, DirtyLayout | DirtyStack);
+		} else
+			for (m = mons; m; m = m->next) markdirty(m, DirtyLayout);
+		return;
+	}
 	if (m) {
 		updatecurrentdesktop(m);
 		showhide(m->stack);
@@ -496,23 +673,45 @@ void arrange(Monitor *m)
 void arrangemon(Monitor *m)
 {
 	strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
-	if (m->lt[m->sellt]->arrange) m->lt[m->sellt]->arrange(m);
+	if (!m->lt[m->sellt]->arrange || cachedlayout(m)) return;
+	gathertiles(m);
+	m->lt[m->sellt]->arrange(m);
+	storelayout(m);
+	tilesmon = NULL;
 }
 
 void attach(Client *c)
 {
-	c->next = c->mon->clients;
-	c->mon->clients = c;
+	attachafter(c, NULL);
+}
+
+/* insert c after p, or at the head when p is NULL; p must be on c->mon */
+void attachafter(Client *c, Client *p)
+{
+	c->prev = p;
+	c->next = p ? p->next : c->mon->clients;
+	if (c->next) c->next->prev = c;
+	if (p)
+		p->next = c;
+	else
+		c->mon->clients = c;
+	c->mon->visvalid = 0;
+	forgetlayouts(c->mon);
+	tagcount(c, 1);
 }
 
 void attachstack(Client *c)
 {
+	c->sprev = NULL;
 	c->snext = c->mon->stack;
+	if (c->snext) c->snext->sprev = c;
 	c->mon->stack = c;
 }
 
 void swallow(Client *p, Client *c)
 {
+	Monitor *m, *nm;
+
 	if (c->noswallow || c->isterminal) return;
 	if (!swallowfloating && c->isfloating) return;
 
@@ -528,10 +727,25 @@ void swallow(Client *p, Client *c)
 	Window w = p->win;
 	p->win = c->win;
 	c->win = w;
+	winindex(p->win, p, WinClient);
+	winindex(c->win, p, WinSwallowed);
+
+	/* the rules may give p other tags or another monitor, keep the counts right */
+	m = p->mon;
+	detach(p);
 	applyrules(p);
+	if (p->mon != m) {
+		nm = p->mon;
+		p->mon = m;
+		detachstack(p);
+		p->mon = nm;
+		attachstack(p);
+	}
+	attach(p);
 	updateicon(p);
 	updatetitle(p);
 	XMoveResizeWindow(dpy, p->win, p->x, p->y, p->w, p->h);
+	p->sentw = 0;
 	arrange(p->mon);
 	configure(p);
 	updateclientlist();
@@ -539,7 +753,10 @@ void swallow(Client *p, Client *c)
 
 void unswallow(Client *c)
 {
+	winunindex(c->win);
+	winunindex(c->swallowing->win);
 	c->win = c->swallowing->win;
+	winindex(c->win, c, WinClient);
 
 	free(c->swallowing);
 	c->swallowing = NULL;
@@ -550,47 +767,19 @@ void unswallow(Client *c)
 	arrange(c->mon);
 	XMapWindow(dpy, c->win);
 	XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+	c->sentw = 0;
 	setclientstate(c, NormalState);
 	focus(NULL);
 	arrange(c->mon);
 }
 
-int processrawtext(char *text)
-{
-	int x = 0, i;
-	int s = strlen(text);
-
-	for (i = 0; i < s && text[i] != '\0'; i++) {
-		if (text[i] == '|') {
-			/* If seperator and next char is not icon (between |0-9|, just 1 character) */
-			if (!BETWEEN(text[i + 1], '0', '9') || i + 2 < s ||
-			    text[i + 2] != '|') {
-				x += (sb_delimiter_w + sb_icon_margin_x * 2) / 2;
-			}
-			x -= TEXTW_SB("|");
-		} else if (BETWEEN(text[i], '0', '9') && text[i + 1] == '|' &&
-			   (i == 0 || text[i - 1] == '|')) {
-			/* If icon, delete seperator margin and add icon size + icon_x_margin */
-			x += sb_icon_wh + sb_icon_margin_x;
-			x -= (sb_delimiter_w + 2 * sb_icon_margin_x) / 2;
-			char tmp[] = { text[i], '\0' };
-			x -= TEXTW_SB(tmp);
-		} else if (text[i + 1] == '|') {
-			/* If next element is seperator add half width */
-			x += (2 * sb_icon_margin_x + sb_delimiter_w) / 2;
-		}
-	}
-
-	x += TEXTW_SB(text);
-	return x;
-}
-
 void buttonpress(XEvent *e)
 {
-	unsigned int i, x, click, occ = 0;
+	unsigned int i, click;
 	Arg arg = { 0 };
 	Client *c;
 	Monitor *m;
+	BarHit *hit;
 	XButtonPressedEvent *ev = &e->xbutton;
 
 	click = ClkRootWin;
@@ -602,9 +791,9 @@ void buttonpress(XEvent *e)
 	}
 
 	if (ev->window == selmon->barwin) {
-		i = 0;
-		x = sb_icon_wh + 2 * sb_delimiter_w;
-		if (ev->x <= x) {
+		if (!(hit = findhit(selmon, ev->x))) goto execute_handler;
+		switch (hit->click) {
+		case HitLogo:
 			if (ev->button == Button1) {
 				Arg a = SHCMD("rofi -show drun");
 				spawn(&a);
@@ -613,34 +802,16 @@ void buttonpress(XEvent *e)
 				spawn(&a);
 			}
 			return;
-		}
-
-		for (c = m->clients; c; c = c->next) occ |= c->tags == 255 ? 0 : c->tags;
-		do {
-			/* do not reserve space for vacant tags */
-			if (!(occ & 1 << i || m->tagset[m->seltags] & 1 << i)) continue;
-			x += TEXTW(tags[i]);
-		} while (ev->x >= x && ++i < LENGTH(tags));
-		if (i < LENGTH(tags)) {
-			click = ClkTagBar;
-			arg.ui = 1 << i;
-			goto execute_handler;
-		} else if (ev->x < x + blw) {
-			click = ClkLtSymbol;
-			goto execute_handler;
-		}
-
-		x += blw;
-
-		for (i = 0; i < lenconfig; i++) {
-			x += TEXTW(config[i].name) + sb_icon_wh + sb_icon_margin_x;
-
-			if (ev->x < x) {
-				Arg a;
-				a.v = config[i].cmd;
-				spawn(&a);
-				return;
-			}
+		case HitConfig:
+			arg.v = config[hit->arg].cmd;
+			spawn(&arg);
+			return;
+		case ClkTagBar:
+			arg.ui = 1 << hit->arg;
+			/* fallthrough */
+		default:
+			click = hit->click;
+			break;
 		}
 	} else if ((c = wintoclient(ev->window))) {
 		focus(c);
@@ -648,26 +819,13 @@ void buttonpress(XEvent *e)
 		XAllowEvents(dpy, ReplayPointer, CurrentTime);
 		click = ClkClientWin;
 	} else if (ev->window == allbarwin[1]) {
-		if (ev->x > (x = 0)) {
+		if (ev->x > 0) {
 			click = ClkStatusText;
-
-			char *text = rawstext;
-			int i = -1;
-			char ch;
-			dwmblockssig = 0;
-			while (text[++i]) {
-				if ((unsigned char)text[i] < ' ') {
-
-					ch = text[i];
-					text[i] = '\0';
-					x += processrawtext(text);
-					text[i] = ch;
-					text += i + 1;
-					i = -1;
-					if (x >= ev->x) break;
-					dwmblockssig = ch;
-				}
-			}
+			for (i = 0; i + 1 < status.n &&
+				    ev->x >= status.items[i].x + status.items[i].w;
+			     i++)
+				;
+			dwmblockssig = status.n ? status.items[i].sig : 0;
 		} else
 			click = ClkWinTitle;
 	}
@@ -682,6 +840,13 @@ execute_handler:
 						&buttons[i].arg);
 }
 
+void buttonrelease(XEvent *e)
+{
+	if (drag.kind == CurNormal) return;
+	dragtimeout(); /* apply the last throttled motion */
+	enddrag(0);
+}
+
 void checkotherwm(void)
 {
 	xerrorxlib = XSetErrorHandler(xerrorstart);
@@ -705,10 +870,15 @@ void cleanup(void)
 		while (m->stack) unmanage(m->stack, 0);
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
 	while (mons) cleanupmon(mons);
+	free(wintab);
+	free(tiles);
+	ipccleanup();
 	XUnmapWindow(dpy, allbarwin[0]);
 	XUnmapWindow(dpy, allbarwin[1]);
 	XDestroyWindow(dpy, allbarwin[0]);
 	XDestroyWindow(dpy, allbarwin[1]);
+	if (titleseg.pix) XFreePixmap(dpy, titleseg.pix);
+	if (statusseg.pix) XFreePixmap(dpy, statusseg.pix);
 	for (i = 0; i < CurLast; i++) drw_cur_free(drw, cursor[i]);
 	for (i = 0; i < LENGTH(colors); i++) free(scheme[i]);
 	XDestroyWindow(dpy, wmcheckwin);
@@ -721,6 +891,7 @@ void cleanup(void)
 void cleanupmon(Monitor *mon)
 {
 	Monitor *m;
+	unsigned int i;
 
 	if (mon == mons)
 		mons = mons->next;
@@ -732,9 +903,20 @@ void cleanupmon(Monitor *mon)
 
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	if (mon->barseg.pix) XFreePixmap(dpy, mon->barseg.pix);
+	for (i = 0; i < LAYOUTCACHE; i++) free(mon->ltcache[i].tiles);
 	free(mon);
 }
 
+void delwatch(int fd)
+{
+	int i;
+
+	for (i = 0; i < nwatches && watches[i].fd != fd; i++)
+		;
+	if (i < nwatches) watches[i] = watches[--nwatches];
+}
+
 void clientmessage(XEvent *e)
 {
 	XWindowAttributes wa;
@@ -753,6 +935,7 @@ void clientmessage(XEvent *e)
 				free(c);
 				return;
 			}
+			winindex(c->win, c, WinSystray);
 			c->mon = selmon;
 			c->next = systray->icons;
 			systray->icons = c;
@@ -859,7 +1042,7 @@ void configurenotify(XEvent *e)
 		sw = ev->width;
 		sh = ev->height;
 		if (updategeom() || dirty) {
-			drw_resize(drw, sw, bh);
+			resizebarbuf();
 			updatebars();
 			for (m = mons; m; m = m->next) {
 				for (c = m->clients; c; c = c->next)
@@ -868,6 +1051,7 @@ void configurenotify(XEvent *e)
 							     m->mh);
 				XMoveResizeWindow(dpy, m->barwin, m->wx + sb_padding_x,
 						  m->by, m->ww - 2 * sb_padding_x, bh);
+				m->barseg.hash = 0;
 			}
 			focus(NULL);
 			arrange(NULL);
@@ -883,9 +1067,10 @@ void configurerequest(XEvent *e)
 	XWindowChanges wc;
 
 	if ((c = wintoclient(ev->window))) {
-		if (ev->value_mask & CWBorderWidth)
+		if (ev->value_mask & CWBorderWidth) {
 			c->bw = ev->border_width;
-		else if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) {
+			forgetlayouts(c->mon);
+		} else if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) {
 			m = c->mon;
 			if (!c->issteam) {
 				if (ev->value_mask & CWX) {
@@ -915,8 +1100,10 @@ void configurerequest(XEvent *e)
 			if ((ev->value_mask & (CWX | CWY)) &&
 			    !(ev->value_mask & (CWWidth | CWHeight)))
 				configure(c);
-			if (ISVISIBLE(c))
+			if (ISVISIBLE(c)) {
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+				c->sentw = 0;
+			}
 		} else
 			configure(c);
 	} else {
@@ -932,18 +1119,6 @@ void configurerequest(XEvent *e)
 	XSync(dpy, False);
 }
 
-void copyvalidchars(char *text, char *rawtext)
-{
-	int i = -1, j = 0;
-
-	while (rawtext[++i]) {
-		if ((unsigned char)rawtext[i] >= ' ') {
-			text[j++] = rawtext[i];
-		}
-	}
-	text[j] = '\0';
-}
-
 Monitor *createmon(void)
 {
 	Monitor *m;
@@ -1015,20 +1190,25 @@ void destroynotify(XEvent *e)
 
 void detach(Client *c)
 {
-	Client **tc;
-
-	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next)
-		;
-	*tc = c->next;
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		c->mon->clients = c->next;
+	if (c->next) c->next->prev = c->prev;
+	c->mon->visvalid = 0;
+	forgetlayouts(c->mon);
+	tagcount(c, -1);
 }
 
 void detachstack(Client *c)
 {
-	Client **tc, *t;
+	Client *t;
 
-	for (tc = &c->mon->stack; *tc && *tc != c; tc = &(*tc)->snext)
-		;
-	*tc = c->snext;
+	if (c->sprev)
+		c->sprev->snext = c->snext;
+	else
+		c->mon->stack = c->snext;
+	if (c->snext) c->snext->sprev = c->sprev;
 
 	if (c == c->mon->sel) {
 		for (t = c->mon->stack; t && !ISVISIBLE(t); t = t->snext)
@@ -1052,13 +1232,85 @@ Monitor *dirtomon(int dir)
 	return m;
 }
 
+void dispatch(XEvent *ev)
+{
+	if (drag.kind != CurNormal) {
+		if (ev->type == MotionNotify) {
+			dragmotion(&ev->xmotion);
+			return;
+		}
+		/* no focus follows mouse or nested grabs while dragging */
+		if (ev->type == EnterNotify || ev->type == ButtonPress) return;
+	}
+	if (handler[ev->type]) handler[ev->type](ev); /* call handler */
+}
+
+void dragmotion(XMotionEvent *ev)
+{
+	int nx, ny, nw, nh;
+	Client *c = drag.c;
+
+	/* apply at most 280 motions a second, the last one is kept for the timer */
+	drag.motion = *ev;
+	drag.pending = 1;
+	if ((ev->time - drag.lasttime) <= (1000 / 280)) {
+		if (!timers[TimerDrag].due) settimer(TimerDrag, 1000 / 280);
+		return;
+	}
+	drag.pending = 0;
+	drag.lasttime = ev->time;
+
+	if (drag.kind == CurMove) {
+		nx = drag.ocx + (ev->x - drag.x);
+		ny = drag.ocy + (ev->y - drag.y);
+		if (abs(selmon->wx - nx) < snap)
+			nx = selmon->wx;
+		else if (abs((selmon->wx + selmon->ww) - (nx + WIDTH(c))) < snap)
+			nx = selmon->wx + selmon->ww - WIDTH(c);
+		if (abs(selmon->wy - ny) < snap)
+			ny = selmon->wy;
+		else if (abs((selmon->wy + selmon->wh) - (ny + HEIGHT(c))) < snap)
+			ny = selmon->wy + selmon->wh - HEIGHT(c);
+		if (!c->isfloating && selmon->lt[selmon->sellt]->arrange &&
+		    (abs(nx - c->x) > snap || abs(ny - c->y) > snap))
+			togglefloating(NULL);
+		if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
+			resize(c, nx, ny, c->w, c->h, 1);
+	} else {
+		nw = MAX(ev->x - drag.ocx - 2 * c->bw + 1, 1);
+		nh = MAX(ev->y - drag.ocy - 2 * c->bw + 1, 1);
+		if (c->mon->wx + nw >= selmon->wx && c->mon->wx + nw <= selmon->wx + selmon->ww &&
+		    c->mon->wy + nh >= selmon->wy && c->mon->wy + nh <= selmon->wy + selmon->wh) {
+			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange &&
+			    (abs(nw - c->w) > snap || abs(nh - c->h) > snap))
+				togglefloating(NULL);
+		}
+		if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
+			resize(c, c->x, c->y, nw, nh, 1);
+	}
+}
+
+void dragtimeout(void)
+{
+	if (drag.kind != CurNormal && drag.pending) {
+		drag.lasttime = 0;
+		dragmotion(&drag.motion);
+	}
+}
+
 void drawbar(Monitor *m)
 {
+	if (batching) {
+		markdirty(m, DirtyBar);
+		return;
+	}
 	if (!m->barwin || !allbarwin[0] || !allbarwin[1]) return;
-	int x, w, y = 0, tw = 0, twtmp = 0, stw = 0;
+	int x, w, y = 0, tw = 0, stw = 0;
 	int boxs = drw->fonts->h / 9;
 	int boxw = drw->fonts->h / 6 + 2;
-	unsigned int i = 0, occ = 0, urg = 0;
+	unsigned int i, h, occ = 0, urg = 0;
+	StatusItem *it;
+	BarHit *hit;
 	Client *c;
 
 	if (showsystray) stw = getsystraywidth();
@@ -1066,127 +1318,117 @@ void drawbar(Monitor *m)
 	/* Status bar is only drawn on selected monitor */
 	if (m == selmon) {
 		load_png_icons(drw, sb_icon_wh, sb_icon_wh);
+		tw = status.w;
+		m->brightstart = m->ww - tw;
 
-		char stextcpy[256];
-		strcpy(stextcpy, stext);
-		sb_arr[i] = strtok(stextcpy, "|");
-
-		while (sb_arr[i] != NULL) {
-			if (strlen(sb_arr[i]) != 1) {
-				tw += TEXTW_SB(sb_arr[i]);
-				tw += sb_delimiter_w + 2 * sb_icon_margin_x;
-			} else
-				tw += sb_icon_wh + sb_icon_margin_x;
-			sb_arr[++i] = strtok(NULL, "|");
-		}
-
-		i = 0;
-		tw += 2 * sb_padding_x;
-		sb_tw = twtmp = tw;
-
-		/* Fill all bar with colorscheme first, some png might have empty locations */
-		drw_setscheme(drw, scheme[SchemeInfoSel]);
-		drw_rect(drw, m->ww - twtmp, y, twtmp + 3 * sb_padding_x + stw, bh, 1, 1);
-		m->brightstart = m->ww - twtmp;
-		XMoveResizeWindow(
-			dpy, allbarwin[1],
-			m->wx + m->brightstart +
-				(showsystray ? -stw - sb_padding_x : sb_padding_x),
-			m->by, stw + twtmp - (showsystray ? 0 : 2 * sb_padding_x), bh);
-		if (showsystray)
-			XMoveResizeWindow(dpy, systray->win, twtmp - sb_padding_x, 0,
-					  (stw ? stw + sb_padding_x : 1), bh);
-		twtmp -= sb_icon_margin_x;
-
-		while (sb_arr[i] != NULL) {
+		unsigned int skey[] = { m->wx, m->by, m->ww,
+					stw, showsystray, status.hash };
+		if (!segcached(&statusseg, seghash(0, skey, sizeof skey))) {
+			/* Fill all bar with colorscheme first, some png might have empty locations */
 			drw_setscheme(drw, scheme[SchemeInfoSel]);
-
-			if (strlen(sb_arr[i]) == 1) {
-				int idx = sb_arr[i++][0] - '0';
-				drw_pic(drw, m->ww - twtmp, (bh - sb_icon_wh) / 2,
-					sb_icon_wh, sb_icon_wh, None, idx);
-				twtmp -= sb_icon_wh + sb_icon_margin_x;
-				drw_text(drw, m->ww - twtmp, y, TEXTW_SB(sb_arr[i]), bh,
-					 0, sb_arr[i], 0);
-				twtmp -= TEXTW_SB(sb_arr[i]);
-			} else {
-				if (sb_arr[i][strlen(sb_arr[i]) - 1] == '%') {
-					char *start = sb_arr[i];
-
-					while (*start < 0) start++;
-					int x = atoi(start);
-
-					if (x <= 30)
-						drw_setscheme(drw,
-							      scheme[SchemeCritical]);
-					else
-						drw_setscheme(drw, scheme[SchemeOptimal]);
+			drw_rect(drw, m->brightstart, y, tw + 3 * sb_padding_x + stw, bh, 1, 1);
+			XMoveResizeWindow(
+				dpy, allbarwin[1],
+				m->wx + m->brightstart +
+					(showsystray ? -stw - sb_padding_x : sb_padding_x),
+				m->by, stw + tw - (showsystray ? 0 : 2 * sb_padding_x), bh);
+			if (showsystray)
+				XMoveResizeWindow(dpy, systray->win, tw - sb_padding_x, 0,
+						  (stw ? stw + sb_padding_x : 1), bh);
+
+			for (i = 0; i < status.n; i++) {
+				it = &status.items[i];
+				x = m->brightstart;
+				if (it->icon >= 0) {
+					drw_setscheme(drw, scheme[SchemeInfoSel]);
+					drw_pic(drw, x + it->iconx, (bh - sb_icon_wh) / 2,
+						sb_icon_wh, sb_icon_wh, None, it->icon);
+				}
+				drw_setscheme(drw, scheme[it->scheme]);
+				drw_text(drw, x + it->textx, y, it->textw, bh, 0,
+					 status.text + it->off, 0);
+
+				/* Below draws seperators */
+				if (i + 1 < status.n || showsystray) {
+					drw_setscheme(drw, scheme[SchemeSel]);
+					drw_rect(drw, x + it->sepx + sb_delimiter_w / 4, y,
+						 sb_delimiter_w / 2, bh, 1, 0);
+					drw_rect(drw, x + it->sepx, y + bh / 10, sb_delimiter_w,
+						 bh - 2 * bh / 10, 1, 0);
 				}
-				drw_text(drw, m->ww - twtmp, y, TEXTW_SB(sb_arr[i]), bh,
-					 0, sb_arr[i], 0);
-				twtmp -= TEXTW_SB(sb_arr[i]);
-			}
-
-			/* Below draws seperators */
-			if (sb_arr[i + 1] != NULL || showsystray) {
-				twtmp -= sb_icon_margin_x;
-				drw_setscheme(drw, scheme[SchemeSel]);
-				drw_rect(drw, m->ww - twtmp + sb_delimiter_w / 4, y,
-					 sb_delimiter_w / 2, bh, 1, 0);
-				drw_rect(drw, m->ww - twtmp, y + bh / 10, sb_delimiter_w,
-					 bh - 2 * bh / 10, 1, 0);
-				twtmp -= sb_delimiter_w + sb_icon_margin_x;
 			}
-			i++;
+			segstore(&statusseg, allbarwin[1], m->brightstart, tw);
 		}
 	}
 
-	for (c = m->clients; c; c = c->next) {
-		occ |= c->tags == 255 ? 0 : c->tags;
-		if (c->isurgent) urg |= c->tags;
-	}
-
-	x = 0;
-	/* Draw logo offset with margin */
-	drw_setscheme(drw, scheme[SchemeTagsSel]);
-	drw_rect(drw, 0, y, 2 * sb_delimiter_w + sb_icon_wh, bh, 1, 0);
-	drw_pic(drw, sb_delimiter_w, y + (bh - sb_icon_wh) / 2, sb_icon_wh, sb_icon_wh,
-		None, 0);
-	x += sb_icon_wh + 2 * sb_delimiter_w;
+	occ = m->occ;
+	urg = m->urg;
 
-	for (i = 0; i < LENGTH(tags) - 1; i++) {
+	/* lay out the left part, it is only drawn again when it changed */
+	m->nhits = 0;
+	x = addhit(m, 0, sb_icon_wh + 2 * sb_delimiter_w, HitLogo, 0);
+	for (i = 0; i < LENGTH(tags) - 1; i++)
 		/* do not draw vacant tags */
-		if (!(occ & 1 << i || m->tagset[m->seltags] & 1 << i)) continue;
-
-		w = TEXTW(tags[i]);
-		drw_setscheme(drw,
-			      scheme[m->tagset[m->seltags] & 1 << i ? SchemeTagsSel :
-								      SchemeTagsNorm]);
-		drw_text(drw, x, y, w, bh, lrpad / 2, tags[i], urg & 1 << i);
-		x += w;
-	}
-	w = blw = TEXTW(m->ltsymbol);
-	drw_setscheme(drw, scheme[SchemeOptimal]);
-	x = drw_text(drw, x, y, w, bh, lrpad / 2, m->ltsymbol, 0);
-
-	for (i = 0; i < lenconfig; i++) {
-		w = strcmp(config[i].name, "") ? TEXTW(config[i].name) : 0;
-		drw_setscheme(drw, scheme[SchemeTagsNorm]);
-		drw_rect(drw, x, y, w + sb_icon_wh + sb_icon_margin_x, bh, 1, 1);
-		drw_text(drw, x, y, w, bh, lrpad / 2, config[i].name, 0);
-		drw_pic(drw, x + w, (bh - sb_icon_wh) / 2, sb_icon_wh, sb_icon_wh, None,
-			i + 1);
-		w += sb_icon_wh + sb_icon_margin_x;
-		x += w;
-	}
-
-	XMoveResizeWindow(dpy, m->barwin, m->wx + sb_padding_x, m->by, x, bh);
+		if (occ & 1 << i || m->tagset[m->seltags] & 1 << i)
+			x = addhit(m, x, TEXTW(tags[i]), ClkTagBar, i);
+	x = addhit(m, x, blw = TEXTW(m->ltsymbol), ClkLtSymbol, 0);
+	for (i = 0; i < lenconfig; i++)
+		x = addhit(m, x,
+			   (strcmp(config[i].name, "") ? TEXTW(config[i].name) : 0) +
+				   sb_icon_wh + sb_icon_margin_x,
+			   HitConfig, i);
 	m->bleftend = x;
 
+	unsigned int lkey[] = { m->wx, m->by, x, occ, urg, m->tagset[m->seltags] };
+	h = seghash(seghash(0, lkey, sizeof lkey), m->ltsymbol, strlen(m->ltsymbol));
+	if (!segcached(&m->barseg, h)) {
+		for (hit = m->hits; hit < m->hits + m->nhits; hit++) {
+			x = hit->x0;
+			w = hit->x1 - hit->x0;
+			switch (hit->click) {
+			case HitLogo: /* Draw logo offset with margin */
+				drw_setscheme(drw, scheme[SchemeTagsSel]);
+				drw_rect(drw, x, y, w, bh, 1, 0);
+				drw_pic(drw, x + sb_delimiter_w, (bh - sb_icon_wh) / 2,
+					sb_icon_wh, sb_icon_wh, None, 0);
+				break;
+			case ClkTagBar:
+				drw_setscheme(drw, scheme[m->tagset[m->seltags] &
+									  1 << hit->arg ?
+								  SchemeTagsSel :
+								  SchemeTagsNorm]);
+				drw_text(drw, x, y, w, bh, lrpad / 2, tags[hit->arg],
+					 urg & 1 << hit->arg);
+				break;
+			case ClkLtSymbol:
+				drw_setscheme(drw, scheme[SchemeOptimal]);
+				drw_text(drw, x, y, w, bh, lrpad / 2, m->ltsymbol, 0);
+				break;
+			case HitConfig:
+				w -= sb_icon_wh + sb_icon_margin_x;
+				drw_setscheme(drw, scheme[SchemeTagsNorm]);
+				drw_rect(drw, x, y, hit->x1 - x, bh, 1, 1);
+				drw_text(drw, x, y, w, bh, lrpad / 2, config[hit->arg].name,
+					 0);
+				drw_pic(drw, x + w, (bh - sb_icon_wh) / 2, sb_icon_wh,
+					sb_icon_wh, None, hit->arg + 1);
+				break;
+			}
+		}
+		x = m->bleftend;
+		XMoveResizeWindow(dpy, m->barwin, m->wx + sb_padding_x, m->by, x, bh);
+		segstore(&m->barseg, m->barwin, 0, x);
+	}
+
 	if ((w = m->ww - tw - x - stw - 2 * sb_padding_x) > bh) {
 		int s;
 		if (m->sel && m == selmon) {
 			c = m->sel;
+			unsigned int tkey[] = { m->wx, m->by, x, w, m->brightstart, stw,
+						c->icon, c->icw, c->ich, c->isfloating,
+						c->isfixed, HIDDEN(c) };
+			h = seghash(seghash(0, tkey, sizeof tkey), c->name, strlen(c->name));
+			if (segcached(&titleseg, h)) return;
 			drw_setscheme(drw, scheme[SchemeStatus]);
 			s = drw_text(drw, x, 0,
 				     MIN(w, TEXTW(c->name) +
@@ -1210,14 +1452,13 @@ void drawbar(Monitor *m)
 							  2 +
 						  2 * sb_padding_x,
 					  m->by, s - 2 * sb_padding_x, bh);
-			drw_map(drw, allbarwin[0], m->bleftend, 0, m->ww, bh);
+			segstore(&titleseg, allbarwin[0], m->bleftend, s);
 		} else if (!m->sel && m == selmon) {
 			XMoveWindow(dpy, allbarwin[0], m->wx + m->ww / 2,
 				    -2 * (bh + sb_padding_y));
+			titleseg.hash = 0;
 		}
 	}
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
-	if (m == selmon) drw_map(drw, allbarwin[1], m->brightstart, 0, m->ww, bh);
 }
 
 void drawbars(void)
@@ -1227,6 +1468,40 @@ void drawbars(void)
 	for (m = mons; m; m = m->next) drawbar(m);
 }
 
+void dumpstats(const Arg *arg)
+{
+	fprintf(stderr, "pdwm: redraws saved: %lu\n", redrawssaved);
+	fprintf(stderr, "pdwm: bar segments reused: %lu\n", segsreused);
+	fprintf(stderr, "pdwm: configures skipped: %lu\n", configsskipped);
+	fprintf(stderr, "pdwm: layouts reused: %lu\n", layoutsreused);
+	drw_dumpstats(drw);
+}
+
+void enddrag(int cancel)
+{
+	int kind = drag.kind;
+	Client *c = drag.c;
+	Monitor *m;
+	XEvent ev;
+
+	drag.kind = CurNormal;
+	drag.c = NULL;
+	timers[TimerDrag].due = 0;
+	if (kind == CurResize && !cancel)
+		XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1,
+			     c->h + c->bw - 1);
+	XUngrabPointer(dpy, CurrentTime);
+	if (cancel) return;
+	if (kind == CurResize)
+		while (XCheckMaskEvent(dpy, EnterWindowMask, &ev))
+			;
+	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
+		sendmon(c, m);
+		selmon = m;
+		focus(NULL);
+	}
+}
+
 void enternotify(XEvent *e)
 {
 	Client *c;
@@ -1251,14 +1526,67 @@ void expose(XEvent *e)
 	Monitor *m;
 	XExposeEvent *ev = &e->xexpose;
 
+	BarSeg *seg = NULL;
+
 	if (ev->count == 0 && (m = wintomon(ev->window))) {
-		drawbar(m);
+		/* bars keep a copy of what they show */
+		if (ev->window == m->barwin)
+			seg = &m->barseg;
+		else if (ev->window == allbarwin[0])
+			seg = &titleseg;
+		else if (ev->window == allbarwin[1])
+			seg = &statusseg;
+		if (seg && seg->pix)
+			XCopyArea(dpy, seg->pix, ev->window, drw->gc, 0, 0, seg->w, bh, 0, 0);
+		else
+			drawbar(m);
 		updatesystray();
 	}
 }
 
+void flushdirty(void)
+{
+	Monitor *m;
+	unsigned int d;
+	int b = batching;
+
+	batching = 0;
+	for (m = mons; m; m = m->next) {
+		if (!(d = m->dirty)) continue;
+		m->dirty = 0;
+		if (d & DirtyLayout) {
+			showhide(m->stack);
+			arrangemon(m);
+		}
+		if (d & DirtyStack)
+			restack(m); /* draws the bar as well */
+		else if (d & DirtyBar)
+			drawbar(m);
+	}
+	batching = b;
+}
+
+BarHit *findhit(Monitor *m, int x)
+{
+	int lo = 0, hi = m->nhits - 1, mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (x < m->hits[mid].x0)
+			hi = mid - 1;
+		else if (x >= m->hits[mid].x1)
+			lo = mid + 1;
+		else
+			return &m->hits[mid];
+	}
+	return NULL;
+}
+
 void focus(Client *c)
 {
+	static Window focused = None;
+	static int focusedmon = -1;
+
 	if (!c || !ISVISIBLE(c)) {
 		for (c = selmon->stack;
 		     c && (!ISVISIBLE(c) || (c->issticky && !selmon->sel->issticky));
@@ -1277,6 +1605,10 @@ void focus(Client *c)
 		if (c->isurgent) seturgent(c, 0);
 		detachstack(c);
 		attachstack(c);
+		if (c->lazy) { /* was occluded, see applytiles() */
+			c->lazy = 0;
+			if (!c->isfloating) resizeclient(c, c->lx, c->ly, c->lw, c->lh);
+		}
 		grabbuttons(c, 1);
 		XSetWindowBorder(dpy, c->win, scheme[SchemeSel][ColBorder].pixel);
 		setfocus(c);
@@ -1284,6 +1616,11 @@ void focus(Client *c)
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
 		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
+	if ((c ? c->win : None) != focused || selmon->num != focusedmon) {
+		focused = c ? c->win : None;
+		focusedmon = selmon->num;
+		ipcevent(EvFocus, "mon=%d win=0x%lx\n", focusedmon, focused);
+	}
 	selmon->sel = c;
 	drawbars();
 }
@@ -1316,25 +1653,24 @@ void focusmon(const Arg *arg)
 void focusstack(const Arg *arg)
 {
 	if (!selmon->sel || !selmon->clients) return;
-	Client *c = NULL, *i;
+	Client *c = NULL, *i, *v = visible(selmon);
 
+	/* sel is visible unless it was just hidden by a tag change */
+	if (!ISVISIBLE(selmon->sel)) return;
 	if (arg->i > 0) {
-		if (selmon->sel)
-			for (c = selmon->sel->next; c && (!ISVISIBLE(c) || HIDDEN(c) || (c->issticky && c->isfloating));
-			     c = c->next)
-				;
-		if (!c || (c->isfloating && c->issticky))
-			for (c = selmon->clients; c && (!ISVISIBLE(c) || HIDDEN(c) || (c->issticky && c->isfloating));
-			     c = c->next)
+		for (c = selmon->sel->curtagnext;
+		     c && (HIDDEN(c) || (c->issticky && c->isfloating)); c = c->curtagnext)
+			;
+		if (!c)
+			for (c = v; c && (HIDDEN(c) || (c->issticky && c->isfloating));
+			     c = c->curtagnext)
 				;
 	} else {
-		if (selmon->sel) {
-			for (i = selmon->clients; i != selmon->sel; i = i->next)
-				if (ISVISIBLE(i) && !HIDDEN(i) && !(i->issticky && i->isfloating)) c = i;
-		}
+		for (i = v; i != selmon->sel; i = i->curtagnext)
+			if (!HIDDEN(i) && !(i->issticky && i->isfloating)) c = i;
 		if (!c)
-			for (; i; i = i->next)
-				if (ISVISIBLE(i) && !HIDDEN(i) && !(i->issticky && i->isfloating)) c = i;
+			for (; i; i = i->curtagnext)
+				if (!HIDDEN(i) && !(i->issticky && i->isfloating)) c = i;
 	}
 
 	if (c) {
@@ -1364,6 +1700,11 @@ Atom getatomprop(Client *c, Atom prop)
 	return atom;
 }
 
+xcb_get_property_cookie_t getprop(Window w, Atom prop, Atom type, uint32_t len)
+{
+	return xcb_get_property(xcon, 0, w, prop, type, 0, len);
+}
+
 unsigned int getsystraywidth()
 {
 	unsigned int w = 0;
@@ -1415,25 +1756,7 @@ long getstate(Window w)
 
 int gettextprop(Window w, Atom atom, char *text, unsigned int size)
 {
-	char **list = NULL;
-	int n;
-	XTextProperty name;
-
-	if (!text || size == 0) return 0;
-	text[0] = '\0';
-	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems) return 0;
-	if (name.encoding == XA_STRING)
-		strncpy(text, (char *)name.value, size - 1);
-	else {
-		if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success &&
-		    n > 0 && *list) {
-			strncpy(text, *list, size - 1);
-			XFreeStringList(list);
-		}
-	}
-	text[size - 1] = '\0';
-	XFree(name.value);
-	return 1;
+	return textreply(getprop(w, atom, AnyPropertyType, UINT32_MAX), text, size);
 }
 
 void grabbuttons(Client *c, int focused)
@@ -1488,6 +1811,12 @@ void grabkeys(void)
 	}
 }
 
+/* something the tiled layouts read changed, see cachedlayout() */
+void forgetlayouts(Monitor *m)
+{
+	if (m) m->ltgen++;
+}
+
 void hide(const Arg *arg)
 {
 	hidewin(selmon->sel);
@@ -1590,7 +1919,7 @@ void layoutmenu(const Arg *arg)
 	setlayout(&((Arg){ .v = &layouts[i] }));
 }
 
-void manage(Window w, XWindowAttributes *wa)
+void manage(Window w, XWindowAttributes *wa, Prefetch *pf)
 {
 	Client *c, *t = NULL, *term = NULL;
 	Window trans = None;
@@ -1598,7 +1927,7 @@ void manage(Window w, XWindowAttributes *wa)
 
 	c = ecalloc(1, sizeof(Client));
 	c->win = w;
-	c->pid = winpid(w);
+	c->pid = pidreply(pf->pid);
 	/* geometry */
 	c->x = c->oldx = wa->x;
 	c->y = c->oldy = wa->y;
@@ -1606,21 +1935,26 @@ void manage(Window w, XWindowAttributes *wa)
 	c->h = c->oldh = wa->height;
 	c->oldbw = wa->border_width;
 
-	updateicon(c);
-	updatetitle(c);
-	updatesizehints(c);
-	updatewmhints(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	/* every property was requested up front, only collect the replies */
+	iconreply(c, pf->prop[PropIcon]);
+	titlereply(c, pf->prop[PropNetName], pf->prop[PropName]);
+	sizehintsreply(c, pf->prop[PropSizeHints]);
+	wmhintsreply(c, pf->prop[PropWMHints]);
+	trans = valuereply(pf->prop[PropTransient]);
+	if (trans != None && (t = wintoclient(trans))) {
+		xcb_discard_reply(xcon, pf->prop[PropClass].sequence);
+		xcb_discard_reply(xcon, pf->prop[PropDesktop].sequence);
 		c->mon = t->mon;
 		c->tags = t->tags;
-		updatewindowtype(c);
+		windowtypereply(c, pf->prop[PropState], pf->prop[PropType]);
 	} else {
 		c->mon = selmon;
-		applyrules(c);
+		rulesreply(c, pf->prop[PropClass], pf->prop[PropDesktop]);
 		term = termforwin(c);
-		updatewindowtype(c);
+		windowtypereply(c, pf->prop[PropState], pf->prop[PropType]);
 		setclienttagprop(c);
 	}
+	c->ishidden = valuereply(pf->prop[PropWMState]) == IconicState;
 
 	if (!c->iscentered) {
 		if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
@@ -1657,6 +1991,9 @@ void manage(Window w, XWindowAttributes *wa)
 	if (c->isfloating) XRaiseWindow(dpy, c->win);
 	attach(c);
 	attachstack(c);
+	winindex(c->win, c, WinClient);
+	ipcevent(EvManage, "win=0x%lx mon=%d tags=%u name=%s\n", c->win, c->mon->num,
+		 c->tags, c->name);
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 			(unsigned char *)&(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w,
@@ -1676,6 +2013,22 @@ void manage(Window w, XWindowAttributes *wa)
 	focus(NULL);
 }
 
+/* Clients are counted once manage() attaches them, c->mon is unset before. */
+void markurgent(Client *c, int urg)
+{
+	if (c->isurgent == urg) return;
+	if (c->mon) tagcount(c, -1);
+	c->isurgent = urg;
+	if (c->mon) tagcount(c, 1);
+}
+
+void markdirty(Monitor *m, unsigned int bits)
+{
+	if ((m->dirty & bits) == bits) redrawssaved++;
+	m->dirty |= bits;
+	if (!batching) flushdirty();
+}
+
 void mappingnotify(XEvent *e)
 {
 	XMappingEvent *ev = &e->xmapping;
@@ -1687,6 +2040,7 @@ void mappingnotify(XEvent *e)
 void maprequest(XEvent *e)
 {
 	static XWindowAttributes wa;
+	Prefetch pf;
 	XMapRequestEvent *ev = &e->xmaprequest;
 	Client *i;
 	if ((i = wintosystrayicon(ev->window))) {
@@ -1696,24 +2050,31 @@ void maprequest(XEvent *e)
 		updatesystray();
 	}
 
-	if (!XGetWindowAttributes(dpy, ev->window, &wa)) return;
-	if (wa.override_redirect) return;
-	if (!wintoclient(ev->window)) manage(ev->window, &wa);
+	if (wintoclient(ev->window)) return;
+	prefetch(ev->window, &pf);
+	if (!XGetWindowAttributes(dpy, ev->window, &wa) || wa.override_redirect)
+		discardprefetch(&pf);
+	else
+		manage(ev->window, &wa, &pf);
 }
 
 void monocle(Monitor *m)
 {
 	unsigned int n;
 	int oh, ov, ih, iv;
-	Client *c;
+	Tile *t;
 
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n > 0) /* override layout symbol */
 		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next))
-		resize(c, m->wx + ov, m->wy + oh, m->ww - 2 * c->bw - 2 * ov,
-		       m->wh - 2 * c->bw - 2 * oh, 0);
+	for (t = tiles; t < tiles + n; t++) {
+		place(t, m->wx + ov, m->wy + oh, m->ww - 2 * t->c->bw - 2 * ov,
+		      m->wh - 2 * t->c->bw - 2 * oh);
+		t->stacked = 1;
+	}
+	applytiles(m, tiles, n);
 }
 
 void motionnotify(XEvent *e)
@@ -1733,69 +2094,97 @@ void motionnotify(XEvent *e)
 
 void movemouse(const Arg *arg)
 {
-	int x, y, ocx, ocy, nx, ny;
 	Client *c;
-	Monitor *m;
-	XEvent ev;
-	Time lasttime = 0;
 
-	if (!(c = selmon->sel)) return;
+	if (!(c = selmon->sel) || drag.kind != CurNormal) return;
 	if (c->isfullscreen) /* no support moving fullscreen windows by mouse */
 		return;
 	restack(selmon);
-	ocx = c->x;
-	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync, None,
 			 cursor[CurMove]->cursor, CurrentTime) != GrabSuccess)
 		return;
-	if (!getrootptr(&x, &y)) return;
-	do {
-		XMaskEvent(dpy, MOUSEMASK | ExposureMask | SubstructureRedirectMask, &ev);
-		switch (ev.type) {
-		case ConfigureRequest:
-		case Expose:
-		case MapRequest:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 280)) continue;
-			handler[ev.type](&ev);
-			break;
-		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 280)) continue;
-			lasttime = ev.xmotion.time;
-
-			nx = ocx + (ev.xmotion.x - x);
-			ny = ocy + (ev.xmotion.y - y);
-			if (abs(selmon->wx - nx) < snap)
-				nx = selmon->wx;
-			else if (abs((selmon->wx + selmon->ww) - (nx + WIDTH(c))) < snap)
-				nx = selmon->wx + selmon->ww - WIDTH(c);
-			if (abs(selmon->wy - ny) < snap)
-				ny = selmon->wy;
-			else if (abs((selmon->wy + selmon->wh) - (ny + HEIGHT(c))) < snap)
-				ny = selmon->wy + selmon->wh - HEIGHT(c);
-			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange &&
-			    (abs(nx - c->x) > snap || abs(ny - c->y) > snap))
-				togglefloating(NULL);
-			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
-				resize(c, nx, ny, c->w, c->h, 1);
-			break;
-		}
-	} while (ev.type != ButtonRelease);
-	XUngrabPointer(dpy, CurrentTime);
-	lasttime = ev.xmotion.time;
-	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
-		sendmon(c, m);
-		selmon = m;
-		focus(NULL);
+	if (!getrootptr(&drag.x, &drag.y)) {
+		XUngrabPointer(dpy, CurrentTime);
+		return;
 	}
+	/* the main loop feeds motion to dragmotion() until the button is released */
+	drag.kind = CurMove;
+	drag.c = c;
+	drag.ocx = c->x;
+	drag.ocy = c->y;
+	drag.pending = 0;
+	drag.lasttime = 0;
 }
 
+/* c is on its monitor's visible list; start with nexttiled(visible(m)) */
 Client *nexttiled(Client *c)
 {
-	for (; c && (c->isfloating || !ISVISIBLE(c) || HIDDEN(c)); c = c->next)
+	for (; c && (c->isfloating || HIDDEN(c)); c = c->curtagnext)
 		;
 	return c;
 }
 
+long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void parsestatus(void)
+{
+	StatusItem *it;
+	char sig = 0, sigs[sizeof stext], *t, *start, *end;
+	int i, j, len, pos = sb_icon_margin_x;
+
+	/* control characters mark where dwmblocks blocks start */
+	for (i = j = 0; rawstext[i]; i++)
+		if ((unsigned char)rawstext[i] < ' ') {
+			sig = rawstext[i];
+		} else {
+			sigs[j] = sig;
+			stext[j++] = rawstext[i];
+		}
+	stext[j] = '\0';
+	memcpy(status.text, stext, j + 1);
+	end = status.text + j;
+	for (t = status.text; (t = strchr(t, '|')); t++) *t = '\0';
+
+	status.n = 0;
+	status.w = 2 * sb_padding_x;
+	for (t = status.text; t < end && status.n < MAXSTATUS; t += len + 1) {
+		if (!(len = strlen(t))) continue;
+		it = &status.items[status.n++];
+		it->sig = sigs[t - status.text];
+		it->x = pos;
+		it->icon = -1;
+		it->scheme = SchemeInfoSel;
+		if (len == 1 && BETWEEN(*t, '0', '9')) {
+			/* a digit names an icon, drawn in front of the next text */
+			it->icon = *t - '0';
+			it->iconx = pos;
+			pos += sb_icon_wh + sb_icon_margin_x;
+			status.w += sb_icon_wh + sb_icon_margin_x;
+			for (t++; t < end && !*t; t++)
+				;
+			len = strlen(t);
+		} else if (t[len - 1] == '%') {
+			for (start = t; *start < 0; start++)
+				;
+			it->scheme = atoi(start) <= 30 ? SchemeCritical : SchemeOptimal;
+		}
+		it->off = t - status.text;
+		it->textx = pos;
+		it->textw = TEXTW_SB(t);
+		if (len) status.w += it->textw + sb_delimiter_w + 2 * sb_icon_margin_x;
+		pos += it->textw + sb_icon_margin_x;
+		it->sepx = pos;
+		pos += sb_delimiter_w + sb_icon_margin_x;
+		it->w = pos - it->x;
+	}
+}
+
 void pop(Client *c)
 {
 	detach(c);
@@ -1804,6 +2193,46 @@ void pop(Client *c)
 	arrange(c->mon);
 }
 
+void prefetch(Window w, Prefetch *pf)
+{
+	pf->pid = pidquery(w);
+	pf->prop[PropIcon] = getprop(w, netatom[NetWMIcon], AnyPropertyType, UINT32_MAX);
+	pf->prop[PropNetName] = getprop(w, netatom[NetWMName], AnyPropertyType, UINT32_MAX);
+	pf->prop[PropName] = getprop(w, XA_WM_NAME, AnyPropertyType, UINT32_MAX);
+	pf->prop[PropSizeHints] = getprop(w, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 18);
+	pf->prop[PropWMHints] = getprop(w, XA_WM_HINTS, XA_WM_HINTS, 9);
+	pf->prop[PropTransient] = getprop(w, XA_WM_TRANSIENT_FOR, XA_WINDOW, 1);
+	pf->prop[PropClass] = getprop(w, XA_WM_CLASS, XA_STRING, UINT32_MAX);
+	pf->prop[PropDesktop] = getprop(w, netatom[NetWMDesktop], XA_CARDINAL, 2);
+	pf->prop[PropState] = getprop(w, netatom[NetWMState], XA_ATOM, 1);
+	pf->prop[PropType] = getprop(w, netatom[NetWMWindowType], XA_ATOM, 1);
+	pf->prop[PropWMState] = getprop(w, wmatom[WMState], wmatom[WMState], 2);
+}
+
+void discardprefetch(Prefetch *pf)
+{
+	int i;
+
+	xcb_discard_reply(xcon, pf->pid.sequence);
+	for (i = 0; i < PropLast; i++) xcb_discard_reply(xcon, pf->prop[i].sequence);
+}
+
+xcb_get_property_reply_t *propreply(xcb_get_property_cookie_t ck)
+{
+	return xcb_get_property_reply(xcon, ck, NULL);
+}
+
+uint32_t valuereply(xcb_get_property_cookie_t ck)
+{
+	uint32_t v = 0;
+	xcb_get_property_reply_t *r;
+
+	if ((r = propreply(ck)) && r->format == 32 && xcb_get_property_value_length(r) >= 4)
+		v = *(uint32_t *)xcb_get_property_value(r);
+	free(r);
+	return v;
+}
+
 void pushstack(const Arg *arg)
 {
 	int i = stackpos(arg);
@@ -1815,12 +2244,11 @@ void pushstack(const Arg *arg)
 		detach(sel);
 		attach(sel);
 	} else {
-		for (p = NULL, c = selmon->clients; c; p = c, c = c->next)
-			if (!(i -= (ISVISIBLE(c) && c != sel))) break;
-		c = c ? c : p;
+		for (p = NULL, c = visible(selmon); c; p = c, c = c->curtagnext)
+			if (!(i -= c != sel)) break;
+		if (!(c = c ? c : p) || c == sel) return;
 		detach(sel);
-		sel->next = c->next;
-		c->next = sel;
+		attachafter(sel, c);
 	}
 	arrange(selmon);
 }
@@ -1833,30 +2261,28 @@ static uint32_t prealpha(uint32_t p)
 	return (rb & 0xFF00FFu) | (g & 0x00FF00u) | (a << 24u);
 }
 
-Picture geticonprop(Window win, unsigned int *picw, unsigned int *pich)
+Picture geticonprop(xcb_get_property_cookie_t ck, unsigned int *picw,
+		    unsigned int *pich)
 {
-	int format;
-	unsigned long n, extra, *p = NULL;
-	Atom real;
+	xcb_get_property_reply_t *r;
+	uint32_t *p, n;
 
-	if (XGetWindowProperty(dpy, win, netatom[NetWMIcon], 0L, LONG_MAX, False,
-			       AnyPropertyType, &real, &format, &n, &extra,
-			       (unsigned char **)&p) != Success)
-		return None;
-	if (n == 0 || format != 32) {
-		XFree(p);
+	if (!(r = propreply(ck))) return None;
+	if (r->format != 32 || (n = xcb_get_property_value_length(r) / 4) == 0) {
+		free(r);
 		return None;
 	}
+	p = xcb_get_property_value(r);
 
-	unsigned long *bstp = NULL;
+	uint32_t *bstp = NULL;
 	uint32_t w, h, sz;
 	{
-		unsigned long *i;
-		const unsigned long *end = p + n;
+		uint32_t *i;
+		const uint32_t *end = p + n;
 		uint32_t bstd = UINT32_MAX, d, m;
 		for (i = p; i < end - 1; i += sz) {
 			if ((w = *i++) >= 16384 || (h = *i++) >= 16384) {
-				XFree(p);
+				free(r);
 				return None;
 			}
 			if ((sz = w * h) > end - i) break;
@@ -1869,7 +2295,7 @@ Picture geticonprop(Window win, unsigned int *picw, unsigned int *pich)
 		if (!bstp) {
 			for (i = p; i < end - 1; i += sz) {
 				if ((w = *i++) >= 16384 || (h = *i++) >= 16384) {
-					XFree(p);
+					free(r);
 					return None;
 				}
 				if ((sz = w * h) > end - i) break;
@@ -1880,13 +2306,13 @@ Picture geticonprop(Window win, unsigned int *picw, unsigned int *pich)
 			}
 		}
 		if (!bstp) {
-			XFree(p);
+			free(r);
 			return None;
 		}
 	}
 
 	if ((w = *(bstp - 2)) == 0 || (h = *(bstp - 1)) == 0) {
-		XFree(p);
+		free(r);
 		return None;
 	}
 
@@ -1903,11 +2329,12 @@ Picture geticonprop(Window win, unsigned int *picw, unsigned int *pich)
 	*picw = icw;
 	*pich = ich;
 
-	uint32_t i, *bstp32 = (uint32_t *)bstp;
-	for (sz = w * h, i = 0; i < sz; ++i) bstp32[i] = prealpha(bstp[i]);
+	/* the reply carries CARD32s as-is, premultiply them in place */
+	uint32_t i;
+	for (sz = w * h, i = 0; i < sz; ++i) bstp[i] = prealpha(bstp[i]);
 
 	Picture ret = drw_picture_create_resized(drw, (char *)bstp, w, h, icw, ich);
-	XFree(p);
+	free(r);
 
 	return ret;
 }
@@ -1929,6 +2356,10 @@ void propertynotify(XEvent *e)
 
 	if ((ev->window == root) && (ev->atom == XA_WM_NAME)) {
 		updatestatus();
+	} else if (ev->atom == wmatom[WMState] && (c = wintoclient(ev->window))) {
+		/* keep the cached state in sync when someone else changes it */
+		c->ishidden = getstate(c->win) == IconicState;
+		forgetlayouts(c->mon);
 	} else if (ev->state == PropertyDelete) {
 		return; /* ignore */
 	} else if ((c = wintoclient(ev->window))) {
@@ -1938,8 +2369,10 @@ void propertynotify(XEvent *e)
 		case XA_WM_TRANSIENT_FOR:
 			if (!c->isfloating &&
 			    (XGetTransientForHint(dpy, c->win, &trans)) &&
-			    (c->isfloating = (wintoclient(trans)) != NULL))
+			    (c->isfloating = (wintoclient(trans)) != NULL)) {
+				forgetlayouts(c->mon);
 				arrange(c->mon);
+			}
 			break;
 		case XA_WM_NORMAL_HINTS:
 			updatesizehints(c);
@@ -1952,7 +2385,7 @@ void propertynotify(XEvent *e)
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updateicon(c);
 			updatetitle(c);
-			if (c == c->mon->sel) drawbar(c->mon);
+			if (c == c->mon->sel) markdirty(c->mon, DirtyBarTitle);
 		}
 		if (ev->atom == netatom[NetWMWindowType]) updatewindowtype(c);
 	}
@@ -1966,6 +2399,7 @@ void removesystrayicon(Client *i)
 	for (ii = &systray->icons; *ii && *ii != i; ii = &(*ii)->next)
 		;
 	if (ii) *ii = i->next;
+	winunindex(i->win);
 	free(i);
 }
 
@@ -2004,10 +2438,25 @@ void resize(Client *c, int x, int y, int w, int h, int interact)
 	if (applysizehints(c, &x, &y, &w, &h, interact)) resizeclient(c, x, y, w, h);
 }
 
+/* The back buffer only ever holds one bar, size it to the widest one. */
+void resizebarbuf(void)
+{
+	Monitor *m;
+	unsigned int w = 1;
+
+	for (m = mons; m; m = m->next) w = MAX(w, m->ww);
+	drw_resize(drw, w, bh);
+}
+
 void resizeclient(Client *c, int x, int y, int w, int h)
 {
 	XWindowChanges wc;
 
+	if (x == c->x && y == c->y && w == c->w && h == c->h && x == c->sentx &&
+	    y == c->senty && w == c->sentw && h == c->senth && c->bw == c->sentbw) {
+		configsskipped++;
+		return;
+	}
 	c->oldx = c->x;
 	c->x = wc.x = x;
 	c->oldy = c->y;
@@ -2020,64 +2469,31 @@ void resizeclient(Client *c, int x, int y, int w, int h)
 	XConfigureWindow(dpy, c->win, CWX | CWY | CWWidth | CWHeight | CWBorderWidth,
 			 &wc);
 	configure(c);
-	XSync(dpy, False);
+	c->sentx = x;
+	c->senty = y;
+	c->sentw = w;
+	c->senth = h;
+	c->sentbw = c->bw;
 }
 
 void resizemouse(const Arg *arg)
 {
-	int ocx, ocy, nw, nh;
 	Client *c;
-	Monitor *m;
-	XEvent ev;
-	Time lasttime = 0;
 
-	if (!(c = selmon->sel)) return;
+	if (!(c = selmon->sel) || drag.kind != CurNormal) return;
 	if (c->isfullscreen) /* no support resizing fullscreen windows by mouse */
 		return;
 	restack(selmon);
-	ocx = c->x;
-	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync, None,
 			 cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
 		return;
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
-	do {
-		XMaskEvent(dpy, MOUSEMASK | ExposureMask | SubstructureRedirectMask, &ev);
-		switch (ev.type) {
-		case ConfigureRequest:
-		case Expose:
-		case MapRequest:
-			handler[ev.type](&ev);
-			break;
-		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 280)) continue;
-			lasttime = ev.xmotion.time;
-
-			nw = MAX(ev.xmotion.x - ocx - 2 * c->bw + 1, 1);
-			nh = MAX(ev.xmotion.y - ocy - 2 * c->bw + 1, 1);
-			if (c->mon->wx + nw >= selmon->wx &&
-			    c->mon->wx + nw <= selmon->wx + selmon->ww &&
-			    c->mon->wy + nh >= selmon->wy &&
-			    c->mon->wy + nh <= selmon->wy + selmon->wh) {
-				if (!c->isfloating &&
-				    selmon->lt[selmon->sellt]->arrange &&
-				    (abs(nw - c->w) > snap || abs(nh - c->h) > snap))
-					togglefloating(NULL);
-			}
-			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
-				resize(c, c->x, c->y, nw, nh, 1);
-			break;
-		}
-	} while (ev.type != ButtonRelease);
-	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
-	XUngrabPointer(dpy, CurrentTime);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev))
-		;
-	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
-		sendmon(c, m);
-		selmon = m;
-		focus(NULL);
-	}
+	drag.kind = CurResize;
+	drag.c = c;
+	drag.ocx = c->x;
+	drag.ocy = c->y;
+	drag.pending = 0;
+	drag.lasttime = 0;
 }
 
 void restack(Monitor *m)
@@ -2086,6 +2502,10 @@ void restack(Monitor *m)
 	XEvent ev;
 	XWindowChanges wc;
 
+	if (batching) {
+		markdirty(m, DirtyStack);
+		return;
+	}
 	drawbar(m);
 	if (!m->sel) return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
@@ -2110,8 +2530,30 @@ void run(void)
 	XEvent ev;
 	/* main event loop */
 	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type]) handler[ev.type](&ev); /* call handler */
+	while (running) {
+		/* drain the whole burst, then lay out and draw once per monitor */
+		batching = 1;
+		waitevents(!XPending(dpy));
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			dispatch(&ev);
+		}
+		batching = 0;
+		flushdirty();
+		XFlush(dpy); /* one flush for everything the batch drew */
+	}
+}
+
+void runtimers(void)
+{
+	int i;
+	long long t = now();
+
+	for (i = 0; i < TimerLast; i++)
+		if (timers[i].due && timers[i].due <= t) {
+			timers[i].due = 0;
+			timers[i].func();
+		}
 }
 
 void runautostart(void)
@@ -2189,29 +2631,109 @@ void runautostart(void)
 
 void scan(void)
 {
-	unsigned int i, num;
+	unsigned int i, j, n, num, *sel;
 	Window d1, d2, *wins = NULL;
-	XWindowAttributes wa;
+	int *istrans, iconic;
+	XWindowAttributes *wa;
+	ScanQuery *q;
+	Prefetch *pf;
+	xcb_get_window_attributes_reply_t *ar;
+	xcb_get_geometry_reply_t *gr;
+
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num)) return;
+	q = ecalloc(num, sizeof(ScanQuery));
+	wa = ecalloc(num, sizeof(XWindowAttributes));
+	istrans = ecalloc(num, sizeof(int));
+	sel = ecalloc(num, sizeof(unsigned int));
+	pf = ecalloc(num, sizeof(Prefetch));
+
+	/* ask about every child of root at once, then collect the replies */
+	for (i = 0; i < num; i++) {
+		q[i].attr = xcb_get_window_attributes(xcon, wins[i]);
+		q[i].geom = xcb_get_geometry(xcon, wins[i]);
+		q[i].trans = getprop(wins[i], XA_WM_TRANSIENT_FOR, XA_WINDOW, 1);
+		q[i].state = getprop(wins[i], wmatom[WMState], wmatom[WMState], 2);
+	}
+	for (i = 0; i < num; i++) {
+		ar = xcb_get_window_attributes_reply(xcon, q[i].attr, NULL);
+		gr = xcb_get_geometry_reply(xcon, q[i].geom, NULL);
+		istrans[i] = valuereply(q[i].trans) != None;
+		iconic = valuereply(q[i].state) == IconicState;
+		if (ar && gr && !ar->override_redirect &&
+		    (ar->map_state == IsViewable || iconic)) {
+			wa[i].x = gr->x;
+			wa[i].y = gr->y;
+			wa[i].width = gr->width;
+			wa[i].height = gr->height;
+			wa[i].border_width = gr->border_width;
+			wa[i].map_state = ar->map_state;
+		} else
+			istrans[i] = -1;
+		free(ar);
+		free(gr);
+	}
 
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa) ||
-			    wa.override_redirect ||
-			    XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable ||
-			    getstate(wins[i]) == IconicState)
-				manage(wins[i], &wa);
-		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)) continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1) &&
-			    (wa.map_state == IsViewable ||
-			     getstate(wins[i]) == IconicState))
-				manage(wins[i], &wa);
-		}
-		if (wins) XFree(wins);
+	/* transients go last so their parents are already managed */
+	for (n = 0, j = 0; j < 2; j++)
+		for (i = 0; i < num; i++)
+			if (istrans[i] == j) sel[n++] = i;
+	for (i = 0; i < n; i++) prefetch(wins[sel[i]], &pf[i]);
+
+	batching = 1;
+	for (i = 0; i < n; i++) manage(wins[sel[i]], &wa[sel[i]], &pf[i]);
+	batching = 0;
+	flushdirty();
+	XSync(dpy, False);
+
+	free(pf);
+	free(sel);
+	free(istrans);
+	free(wa);
+	free(q);
+	if (wins) XFree(wins);
+}
+/* Returns 1 if seg already holds what hashes to h, else records h for the
+ * redraw that follows.
+ */
+int segcached(BarSeg *seg, unsigned int h)
+{
+	if (seg->pix && seg->hash == h) {
+		segsreused++;
+		return 1;
+	}
+	seg->hash = h;
+	return 0;
+}
+
+unsigned int seghash(unsigned int h, const void *p, size_t n)
+{
+	const unsigned char *b = p;
+
+	if (!h) h = 2166136261u;
+	while (n--) h = (h ^ *b++) * 16777619u;
+	return h ? h : 1;
+}
+
+/* Copies the segment just drawn at x to win and keeps it for exposes. */
+void segstore(BarSeg *seg, Window win, int x, unsigned int w)
+{
+	if (!w) return;
+	if (seg->w < w) {
+		if (seg->pix) XFreePixmap(dpy, seg->pix);
+		seg->pix = XCreatePixmap(dpy, root, w, bh, DefaultDepth(dpy, screen));
+		seg->w = w;
 	}
+	XCopyArea(dpy, drw->drawable, seg->pix, drw->gc, x, 0, w, bh, 0, 0);
+#ifdef PRESENT
+	if (present) {
+		/* copied to win at the next vblank */
+		xcb_present_pixmap(xcon, win, seg->pix, ++presentserial, XCB_NONE, XCB_NONE, 0,
+				   0, XCB_NONE, XCB_NONE, XCB_NONE, XCB_PRESENT_OPTION_COPY, 0,
+				   0, 0, 0, NULL);
+		return;
+	}
+#endif /* PRESENT */
+	drw_map(drw, win, x, 0, w, bh);
 }
 
 void sendmon(Client *c, Monitor *m)
@@ -2233,6 +2755,8 @@ void setclientstate(Client *c, long state)
 {
 	long data[] = { state, None };
 
+	c->ishidden = state == IconicState;
+	forgetlayouts(c->mon);
 	XChangeProperty(dpy, c->win, wmatom[WMState], wmatom[WMState], 32,
 			PropModeReplace, (unsigned char *)data, 2);
 }
@@ -2288,6 +2812,15 @@ void setfocus(Client *c)
 		  CurrentTime, 0, 0, 0);
 }
 
+void settags(Client *c, unsigned int tags)
+{
+	tagcount(c, -1);
+	c->tags = tags;
+	c->mon->visvalid = 0;
+	forgetlayouts(c->mon);
+	tagcount(c, 1);
+}
+
 void setfullscreen(Client *c, int fullscreen)
 {
 	if (fullscreen && !c->isfullscreen) {
@@ -2299,6 +2832,7 @@ void setfullscreen(Client *c, int fullscreen)
 		c->oldbw = c->bw;
 		c->bw = 0;
 		c->isfloating = 1;
+		forgetlayouts(c->mon);
 		resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
 		XRaiseWindow(dpy, c->win);
 	} else if (!fullscreen && c->isfullscreen) {
@@ -2307,6 +2841,7 @@ void setfullscreen(Client *c, int fullscreen)
 		c->isfullscreen = 0;
 		c->isfloating = c->oldstate;
 		c->bw = c->oldbw;
+		forgetlayouts(c->mon);
 		c->x = c->oldx;
 		c->y = c->oldy;
 		c->w = c->oldw;
@@ -2328,21 +2863,18 @@ int stackpos(const Arg *arg)
 		     l = l->snext)
 			;
 		if (!l) return -1;
-		for (i = 0, c = selmon->clients; c != l;
-		     i += ISVISIBLE(c) ? 1 : 0, c = c->next)
+		for (i = 0, c = visible(selmon); c != l; i++, c = c->curtagnext)
 			;
 		return i;
 	} else if (ISINC(arg->i)) {
-		if (!selmon->sel) return -1;
-		for (i = 0, c = selmon->clients; c != selmon->sel;
-		     i += ISVISIBLE(c) ? 1 : 0, c = c->next)
+		if (!selmon->sel || !ISVISIBLE(selmon->sel)) return -1;
+		for (i = 0, c = visible(selmon); c != selmon->sel; i++, c = c->curtagnext)
 			;
-		for (n = i; c; n += ISVISIBLE(c) ? 1 : 0, c = c->next)
+		for (n = i; c; n++, c = c->curtagnext)
 			;
 		return MOD(i + GETINC(arg->i), n);
 	} else if (arg->i < 0) {
-		for (i = 0, c = selmon->clients; c;
-		     i += ISVISIBLE(c) ? 1 : 0, c = c->next)
+		for (i = 0, c = visible(selmon); c; i++, c = c->curtagnext)
 			;
 		return MAX(i + arg->i, 0);
 	} else
@@ -2359,6 +2891,7 @@ void setlayout(const Arg *arg)
 				(Layout *)arg->v;
 	strncpy(selmon->ltsymbol, selmon->lt[selmon->sellt]->symbol,
 		sizeof selmon->ltsymbol);
+	ipcevent(EvLayout, "mon=%d symbol=%s\n", selmon->num, selmon->ltsymbol);
 	if (selmon->sel)
 		arrange(selmon);
 	else
@@ -2383,22 +2916,49 @@ void setup(void)
 	XSetWindowAttributes wa;
 	Atom utf8string;
 
-	/* clean up any zombies immediately */
-	sigchld(0);
+	/* signals only wake the main loop, the work happens in sigread() */
+	struct sigaction sa = { .sa_handler = sigwake, .sa_flags = SA_RESTART };
+	sigemptyset(&sa.sa_mask);
+	if (pipe(sigpipe) == -1) die("pipe:");
+	for (i = 0; i < 2; i++) {
+		fcntl(sigpipe[i], F_SETFL, fcntl(sigpipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	if (sigaction(SIGCHLD, &sa, NULL) == -1 || sigaction(SIGHUP, &sa, NULL) == -1 ||
+	    sigaction(SIGTERM, &sa, NULL) == -1)
+		die("can't install signal handlers:");
+	addwatch(sigpipe[0], POLLIN, sigread);
 
-	signal(SIGHUP, sighup);
-	signal(SIGTERM, sigterm);
+	/* clean up any zombies immediately */
+	while (0 < waitpid(-1, NULL, WNOHANG))
+		;
 
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
+	drw = drw_create(dpy, screen, root, 1, 1);
 	if (!drw_fontset_create(drw, fonts, lenfonts)) die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
 	bh = user_bh ? user_bh : drw->fonts->h + 2;
 	updategeom();
+	resizebarbuf();
+#ifdef PRESENT
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_reply_t *pv;
+
+	ext = xcb_get_extension_data(xcon, &xcb_present_id);
+	if (ext && ext->present &&
+	    (pv = xcb_present_query_version_reply(
+		     xcon,
+		     xcb_present_query_version(xcon, XCB_PRESENT_MAJOR_VERSION,
+					       XCB_PRESENT_MINOR_VERSION),
+		     NULL))) {
+		present = 1;
+		free(pv);
+	}
+#endif /* PRESENT */
 	/* init atoms */
 	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
 	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
@@ -2463,6 +3023,7 @@ void setup(void)
 	XChangeWindowAttributes(dpy, root, CWEventMask | CWCursor, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
 	grabkeys();
+	ipcinit();
 	focus(NULL);
 }
 
@@ -2470,7 +3031,7 @@ void seturgent(Client *c, int urg)
 {
 	XWMHints *wmh;
 
-	c->isurgent = urg;
+	markurgent(c, urg);
 	if (!(wmh = XGetWMHints(dpy, c->win))) return;
 	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
 	XSetWMHints(dpy, c->win, wmh);
@@ -2510,23 +3071,46 @@ void showwin(Client *c)
 	arrange(c->mon);
 }
 
-void sigchld(int unused)
+void settimer(int id, int ms)
 {
-	if (signal(SIGCHLD, sigchld) == SIG_ERR) die("can't install SIGCHLD handler:");
-	while (0 < waitpid(-1, NULL, WNOHANG))
-		;
+	timers[id].due = now() + ms;
 }
 
-void sighup(int unused)
+void setwatch(int fd, short events)
 {
-	Arg a = { .i = 1 };
-	quit(&a);
+	int i;
+
+	for (i = 0; i < nwatches; i++)
+		if (watches[i].fd == fd) watches[i].events = events;
 }
 
-void sigterm(int unused)
+void sigread(int fd, short revents)
 {
-	Arg a = { .i = 0 };
-	quit(&a);
+	unsigned char sig;
+
+	while (read(fd, &sig, 1) == 1) {
+		switch (sig) {
+		case SIGCHLD:
+			while (0 < waitpid(-1, NULL, WNOHANG))
+				;
+			break;
+		case SIGHUP:
+			quit(&((Arg){ .i = 1 }));
+			break;
+		case SIGTERM:
+			quit(&((Arg){ .i = 0 }));
+			break;
+		}
+	}
+}
+
+void sigwake(int sig)
+{
+	int saved = errno;
+	unsigned char c = sig;
+
+	write(sigpipe[1], &c, 1);
+	errno = saved;
 }
 
 #ifndef __OpenBSD__
@@ -2563,13 +3147,32 @@ void tag(const Arg *arg)
 	Client *c;
 	if (selmon->sel && arg->ui & TAGMASK) {
 		c = selmon->sel;
-		selmon->sel->tags = arg->ui & TAGMASK;
+		settags(c, arg->ui & TAGMASK);
 		setclienttagprop(c);
 		focus(NULL);
 		arrange(selmon);
 	}
 }
 
+/* Adds c to (n = 1) or removes it from (n = -1) its monitor's tag counts. */
+void tagcount(Client *c, int n)
+{
+	Monitor *m = c->mon;
+	unsigned int i, bit;
+
+	for (i = 0; i < LENGTH(m->nocc); i++) {
+		if (!(c->tags & (bit = 1u << i))) continue;
+		if (c->tags != 255) {
+			m->nocc[i] += n;
+			m->occ = m->nocc[i] ? m->occ | bit : m->occ & ~bit;
+		}
+		if (c->isurgent) {
+			m->nurg[i] += n;
+			m->urg = m->nurg[i] ? m->urg | bit : m->urg & ~bit;
+		}
+	}
+}
+
 void tagmon(const Arg *arg)
 {
 	if (!selmon->sel || !mons->next) return;
@@ -2591,6 +3194,7 @@ void togglefloating(const Arg *arg)
 	if (selmon->sel->isfullscreen) /* no support for fullscreen windows */
 		return;
 	selmon->sel->isfloating = !selmon->sel->isfloating || selmon->sel->isfixed;
+	forgetlayouts(selmon);
 	if (selmon->sel->isfloating)
 		resize(selmon->sel, selmon->sel->x, selmon->sel->y, selmon->sel->w,
 		       selmon->sel->h, 0);
@@ -2622,6 +3226,7 @@ void togglescratch(const Arg *arg)
 		unsigned int newtagset = selmon->tagset[selmon->seltags] ^ scratchtag;
 		if (newtagset) {
 			selmon->tagset[selmon->seltags] = newtagset;
+			selmon->visvalid = 0;
 			focus(NULL);
 			arrange(selmon);
 		}
@@ -2631,6 +3236,7 @@ void togglescratch(const Arg *arg)
 		}
 	} else {
 		selmon->tagset[selmon->seltags] |= scratchtag;
+		selmon->visvalid = 0;
 		spawn(&sparg);
 	}
 }
@@ -2642,7 +3248,7 @@ void toggletag(const Arg *arg)
 	if (!selmon->sel) return;
 	newtags = selmon->sel->tags ^ (arg->ui & TAGMASK);
 	if (newtags) {
-		selmon->sel->tags = newtags;
+		settags(selmon->sel, newtags);
 		setclienttagprop(selmon->sel);
 		focus(NULL);
 		arrange(selmon);
@@ -2656,6 +3262,7 @@ void toggleview(const Arg *arg)
 
 	if (newtagset) {
 		selmon->tagset[selmon->seltags] = newtagset;
+		selmon->visvalid = 0;
 
 		if (newtagset == ~0) {
 			selmon->pertag->prevtag = selmon->pertag->curtag;
@@ -2682,6 +3289,9 @@ void toggleview(const Arg *arg)
 		if (selmon->showbar != selmon->pertag->showbars[selmon->pertag->curtag])
 			togglebar(NULL);
 
+		ipcevent(EvTags, "mon=%d tags=%u\n", selmon->num, newtagset);
+		ipcevent(EvLayout, "mon=%d symbol=%s\n", selmon->num,
+			 selmon->lt[selmon->sellt]->symbol);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -2719,6 +3329,7 @@ void unmanage(Client *c, int destroyed)
 
 	Client *s = swallowingclient(c->win);
 	if (s) {
+		winunindex(c->win);
 		free(s->swallowing);
 		s->swallowing = NULL;
 		arrange(m);
@@ -2728,6 +3339,9 @@ void unmanage(Client *c, int destroyed)
 
 	detach(c);
 	detachstack(c);
+	winunindex(c->win);
+	if (drag.c == c) enddrag(1);
+	ipcevent(EvUnmanage, "win=0x%lx mon=%d\n", c->win, m->num);
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -2847,6 +3461,34 @@ void updatebarpos(Monitor *m)
 	}
 }
 
+void waitevents(int block)
+{
+	struct pollfd pfd[MAXWATCH + 1];
+	int i, n, timeout = block ? -1 : 0;
+	long long t, due = 0;
+
+	for (i = 0; i < TimerLast; i++)
+		if (timers[i].due && (!due || timers[i].due < due)) due = timers[i].due;
+	if (due && block) timeout = (t = due - now()) > 0 ? t : 0;
+
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[0].events = POLLIN;
+	for (i = 0; i < nwatches; i++) {
+		pfd[i + 1].fd = watches[i].fd;
+		pfd[i + 1].events = watches[i].events;
+	}
+	n = nwatches;
+	if (poll(pfd, n + 1, timeout) == -1) {
+		if (errno == EINTR) return;
+		die("pdwm: poll:");
+	}
+	/* callbacks may add or remove watches, match them up by descriptor */
+	for (i = 0; i < n; i++)
+		if (pfd[i + 1].revents && i < nwatches && watches[i].fd == pfd[i + 1].fd)
+			watches[i].func(pfd[i + 1].fd, pfd[i + 1].revents);
+	runtimers();
+}
+
 void updatecurrentdesktop(Monitor *m)
 {
 	long data[] = { (long)m->tagset[m->seltags] };
@@ -2918,7 +3560,7 @@ int updategeom(void)
 					;
 				while ((c = m->clients)) {
 					dirty = 1;
-					m->clients = c->next;
+					detach(c);
 					detachstack(c);
 					c->mon = mons;
 					attach(c);
@@ -2964,12 +3606,37 @@ void updatenumlockmask(void)
 
 void updatesizehints(Client *c)
 {
-	long msize;
-	XSizeHints size;
-
-	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
-		/* size is uninitialized, ensure that size.flags aren't used */
-		size.flags = PSize;
+	sizehintsreply(c, getprop(c->win, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 18));
+}
+
+void sizehintsreply(Client *c, xcb_get_property_cookie_t ck)
+{
+	XSizeHints size = { .flags = PSize };
+	xcb_get_property_reply_t *r;
+	uint32_t *v;
+
+	/* WM_NORMAL_HINTS is 18 CARD32s, pre-ICCCM clients only send the first 15 */
+	if ((r = propreply(ck)) && r->format == 32 &&
+	    xcb_get_property_value_length(r) >= 15 * 4) {
+		v = xcb_get_property_value(r);
+		size.flags = v[0];
+		size.min_width = v[5];
+		size.min_height = v[6];
+		size.max_width = v[7];
+		size.max_height = v[8];
+		size.width_inc = v[9];
+		size.height_inc = v[10];
+		size.min_aspect.x = v[11];
+		size.min_aspect.y = v[12];
+		size.max_aspect.x = v[13];
+		size.max_aspect.y = v[14];
+		if (xcb_get_property_value_length(r) >= 18 * 4) {
+			size.base_width = v[15];
+			size.base_height = v[16];
+		} else
+			size.flags &= ~PBaseSize;
+	}
+	free(r);
 	if (size.flags & PBaseSize) {
 		c->basew = size.base_width;
 		c->baseh = size.base_height;
@@ -3002,60 +3669,104 @@ void updatesizehints(Client *c)
 	} else
 		c->maxa = c->mina = 0.0;
 	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
+	forgetlayouts(c->mon);
 }
 
 void updatestatus(void)
 {
-	if (!gettextprop(root, XA_WM_NAME, rawstext, sizeof(rawstext)))
-		strcpy(stext, "pdwm-" VERSION);
-	else
-		copyvalidchars(stext, rawstext);
-	drawbar(selmon);
+	char text[sizeof rawstext];
+	unsigned int h;
+
+	if (!gettextprop(root, XA_WM_NAME, text, sizeof(text)))
+		strcpy(text, "pdwm-" VERSION);
+	/* status scripts often set the same text again */
+	if ((h = seghash(0, text, strlen(text))) == status.hash) return;
+	status.hash = h;
+	strcpy(rawstext, text);
+	parsestatus();
+	markdirty(selmon, DirtyBarStatus);
 }
 
 void updatetitle(Client *c)
 {
-	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
-		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
+	titlereply(c, getprop(c->win, netatom[NetWMName], AnyPropertyType, UINT32_MAX),
+		   getprop(c->win, XA_WM_NAME, AnyPropertyType, UINT32_MAX));
+	ipcevent(EvTitle, "win=0x%lx name=%s\n", c->win, c->name);
+}
+
+void titlereply(Client *c, xcb_get_property_cookie_t netname,
+		xcb_get_property_cookie_t name)
+{
+	if (textreply(netname, c->name, sizeof c->name))
+		xcb_discard_reply(xcon, name.sequence);
+	else
+		textreply(name, c->name, sizeof c->name);
 	if (c->name[0] == '\0') /* hack to mark broken clients */
 		strcpy(c->name, broken);
 }
 
 void updateicon(Client *c)
+{
+	iconreply(c, getprop(c->win, netatom[NetWMIcon], AnyPropertyType, UINT32_MAX));
+}
+
+void iconreply(Client *c, xcb_get_property_cookie_t ck)
 {
 	freeicon(c);
-	c->icon = geticonprop(c->win, &c->icw, &c->ich);
+	c->icon = geticonprop(ck, &c->icw, &c->ich);
+	titleseg.hash = 0; /* a new icon may reuse the old picture id */
 }
 
 void updatewindowtype(Client *c)
 {
-	Atom state = getatomprop(c, netatom[NetWMState]);
-	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
+	windowtypereply(c, getprop(c->win, netatom[NetWMState], XA_ATOM, 1),
+			getprop(c->win, netatom[NetWMWindowType], XA_ATOM, 1));
+}
+
+void windowtypereply(Client *c, xcb_get_property_cookie_t statck,
+		     xcb_get_property_cookie_t typeck)
+{
+	Atom state = valuereply(statck);
+	Atom wtype = valuereply(typeck);
 
 	if (state == netatom[NetWMFullscreen]) setfullscreen(c, 1);
 	if (wtype == netatom[NetWMWindowTypeDialog]) {
 		c->iscentered = 1;
 		c->isfloating = 1;
+		forgetlayouts(c->mon);
 	}
 	if (state == netatom[NetWMSticky]) setsticky(c, 1);
 }
 
 void updatewmhints(Client *c)
 {
-	XWMHints *wmh;
+	wmhintsreply(c, getprop(c->win, XA_WM_HINTS, XA_WM_HINTS, 9));
+}
 
-	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
-		XFree(wmh);
+void wmhintsreply(Client *c, xcb_get_property_cookie_t ck)
+{
+	xcb_get_property_reply_t *r;
+	uint32_t *wmh;
+	int len;
+
+	/* WM_HINTS is 9 CARD32s: flags, input, initial_state, ... */
+	if (!(r = propreply(ck)) || r->format != 32 ||
+	    (len = xcb_get_property_value_length(r)) < 2 * 4) {
+		free(r);
+		return;
 	}
+	wmh = xcb_get_property_value(r);
+	if (c == selmon->sel && wmh[0] & XUrgencyHint) {
+		wmh[0] &= ~XUrgencyHint;
+		xcb_change_property(xcon, XCB_PROP_MODE_REPLACE, c->win, XA_WM_HINTS,
+				    XA_WM_HINTS, 32, len / 4, wmh);
+	} else
+		markurgent(c, (wmh[0] & XUrgencyHint) ? 1 : 0);
+	if (wmh[0] & InputHint)
+		c->neverfocus = !wmh[1];
+	else
+		c->neverfocus = 0;
+	free(r);
 }
 
 void view(const Arg *arg)
@@ -3065,6 +3776,7 @@ void view(const Arg *arg)
 
 	if ((arg->ui & TAGMASK) == selmon->tagset[selmon->seltags]) return;
 	selmon->seltags ^= 1; /* toggle sel tagset */
+	selmon->visvalid = 0;
 	if (arg->ui & TAGMASK) {
 		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK;
 		selmon->pertag->prevtag = selmon->pertag->curtag;
@@ -3093,21 +3805,27 @@ void view(const Arg *arg)
 	if (selmon->showbar != selmon->pertag->showbars[selmon->pertag->curtag])
 		togglebar(NULL);
 
+	ipcevent(EvTags, "mon=%d tags=%u\n", selmon->num, selmon->tagset[selmon->seltags]);
+	ipcevent(EvLayout, "mon=%d symbol=%s\n", selmon->num,
+		 selmon->lt[selmon->sellt]->symbol);
 	focus(NULL);
 	arrange(selmon);
 }
 
-pid_t winpid(Window w)
+xcb_res_query_client_ids_cookie_t pidquery(Window w)
 {
-	pid_t result = 0;
-
 	xcb_res_client_id_spec_t spec = { 0 };
 	spec.client = w;
 	spec.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID;
 
-	xcb_generic_error_t *e = NULL;
-	xcb_res_query_client_ids_cookie_t c = xcb_res_query_client_ids(xcon, 1, &spec);
-	xcb_res_query_client_ids_reply_t *r = xcb_res_query_client_ids_reply(xcon, c, &e);
+	return xcb_res_query_client_ids(xcon, 1, &spec);
+}
+
+pid_t pidreply(xcb_res_query_client_ids_cookie_t c)
+{
+	pid_t result = 0;
+	xcb_res_client_id_spec_t spec;
+	xcb_res_query_client_ids_reply_t *r = xcb_res_query_client_ids_reply(xcon, c, NULL);
 
 	if (!r) return (pid_t)0;
 
@@ -3177,22 +3895,12 @@ Client *termforwin(const Client *w)
 
 Client *swallowingclient(Window w)
 {
-	Client *c;
-	Monitor *m;
-
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->swallowing && c->swallowing->win == w) return c;
-		}
-	}
-
-	return NULL;
+	return winlookup(w, WinSwallowed);
 }
 
 void shiftview(const Arg *arg)
 {
 	Arg a;
-	Client *c;
 	unsigned visible = 0;
 	int i = arg->i;
 	int count = 0;
@@ -3208,11 +3916,7 @@ void shiftview(const Arg *arg)
 				curseltags >> (-i) | (curseltags << (LENGTH(tags) + i));
 
 		// Check if tag is visible
-		for (c = selmon->clients; c && !visible; c = c->next)
-			if (nextseltags & c->tags) {
-				visible = 1;
-				break;
-			}
+		visible = !!(nextseltags & selmon->occ);
 		i += arg->i;
 	} while (!visible && ++count < 10);
 
@@ -3225,7 +3929,6 @@ void shiftview(const Arg *arg)
 void shifttag(const Arg *arg)
 {
 	Arg a;
-	Client *c;
 	unsigned visible = 0;
 	int i = arg->i;
 	int count = 0;
@@ -3241,11 +3944,7 @@ void shifttag(const Arg *arg)
 				curseltags >> (-i) | (curseltags << (LENGTH(tags) + i));
 
 		// Check if tag is visible
-		for (c = selmon->clients; c && !visible; c = c->next)
-			if (nextseltags & c->tags) {
-				visible = 1;
-				break;
-			}
+		visible = !!(nextseltags & selmon->occ);
 		i += arg->i;
 	} while (!visible && ++count < 10);
 
@@ -3311,25 +4010,93 @@ void updatesystray(void)
 	XSync(dpy, False);
 }
 
+/* rebuild the list of ISVISIBLE clients after a tag, tagset or membership change */
+Client *visible(Monitor *m)
+{
+	Client *c, **tc = &m->vis;
+
+	if (m->visvalid) return m->vis;
+	for (c = m->clients; c; c = c->next)
+		if (ISVISIBLE(c)) {
+			*tc = c;
+			tc = &c->curtagnext;
+		}
+	*tc = NULL;
+	m->visvalid = 1;
+	return m->vis;
+}
+
 Client *wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
+	return winlookup(w, WinClient);
+}
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w) return c;
+static unsigned int winhash(Window w)
+{
+	uint32_t h = (uint32_t)w * 2654435761u;
+
+	return h ^ (h >> 16);
+}
+
+/* Open addressing with linear probing, slots with win == None are empty. */
+void winindex(Window w, Client *c, int kind)
+{
+	WinEntry *old = wintab;
+	unsigned int i, oldsize = wintabsize;
+
+	if (2 * (wintablen + 1) > wintabsize) {
+		wintabsize = wintabsize ? 2 * wintabsize : 64;
+		wintab = ecalloc(wintabsize, sizeof(WinEntry));
+		wintablen = 0;
+		for (i = 0; i < oldsize; i++)
+			if (old[i].win) winindex(old[i].win, old[i].c, old[i].kind);
+		free(old);
+	}
+	for (i = winhash(w) & (wintabsize - 1); wintab[i].win && wintab[i].win != w;
+	     i = (i + 1) & (wintabsize - 1))
+		;
+	if (!wintab[i].win) wintablen++;
+	wintab[i].win = w;
+	wintab[i].c = c;
+	wintab[i].kind = kind;
+}
+
+Client *winlookup(Window w, int kind)
+{
+	unsigned int i;
+
+	if (!wintab || !w) return NULL;
+	for (i = winhash(w) & (wintabsize - 1); wintab[i].win;
+	     i = (i + 1) & (wintabsize - 1))
+		if (wintab[i].win == w) return wintab[i].kind == kind ? wintab[i].c : NULL;
 	return NULL;
 }
 
-Client *wintosystrayicon(Window w)
+void winunindex(Window w)
 {
-	Client *i = NULL;
+	unsigned int i, j, k, mask = wintabsize - 1;
 
-	if (!showsystray || !w) return i;
-	for (i = systray->icons; i && i->win != w; i = i->next)
+	if (!wintab || !w) return;
+	for (i = winhash(w) & mask; wintab[i].win && wintab[i].win != w; i = (i + 1) & mask)
 		;
-	return i;
+	if (!wintab[i].win) return;
+	/* shift following entries back instead of leaving tombstones */
+	for (j = i;;) {
+		j = (j + 1) & mask;
+		if (!wintab[j].win) break;
+		k = winhash(wintab[j].win) & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+		wintab[i] = wintab[j];
+		i = j;
+	}
+	wintab[i].win = None;
+	wintablen--;
+}
+
+Client *wintosystrayicon(Window w)
+{
+	if (!showsystray) return NULL;
+	return winlookup(w, WinSystray);
 }
 
 Monitor *wintomon(Window w)
@@ -3385,8 +4152,8 @@ void zoom(const Arg *arg)
 	if (!selmon->lt[selmon->sellt]->arrange ||
 	    (selmon->sel && selmon->sel->isfloating))
 		return;
-	if (c == nexttiled(selmon->clients))
-		if (!c || !(c = nexttiled(c->next))) return;
+	if (c == nexttiled(visible(selmon)))
+		if (!c || !(c = nexttiled(c->curtagnext))) return;
 	pop(c);
 }
 
@@ -3398,29 +4165,73 @@ void setsticky(Client *c, int sticky)
 				PropModeReplace, (unsigned char *)&netatom[NetWMSticky],
 				1);
 		c->issticky = 1;
+		c->mon->visvalid = 0;
+		forgetlayouts(c->mon);
 	} else if (!sticky && c->issticky) {
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 				PropModeReplace, (unsigned char *)0, 0);
 		c->issticky = 0;
+		c->mon->visvalid = 0;
+		forgetlayouts(c->mon);
 		arrange(c->mon);
 	}
 }
 
+int textreply(xcb_get_property_cookie_t ck, char *text, unsigned int size)
+{
+	char **list = NULL;
+	int n, len;
+	XTextProperty name;
+	xcb_get_property_reply_t *r;
+
+	if (!text || size == 0) {
+		xcb_discard_reply(xcon, ck.sequence);
+		return 0;
+	}
+	text[0] = '\0';
+	if (!(r = propreply(ck)) || !r->format ||
+	    !(len = xcb_get_property_value_length(r))) {
+		free(r);
+		return 0;
+	}
+	name.value = xcb_get_property_value(r);
+	name.encoding = r->type;
+	name.format = r->format;
+	name.nitems = len / (r->format / 8);
+	if (name.encoding == XA_STRING) {
+		len = MIN(len, size - 1);
+		memcpy(text, name.value, len);
+		text[len] = '\0';
+	} else {
+		if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success &&
+		    n > 0 && *list) {
+			strncpy(text, *list, size - 1);
+			XFreeStringList(list);
+		}
+	}
+	text[size - 1] = '\0';
+	free(r);
+	return 1;
+}
+
 void swaptags(const Arg *arg)
 {
 	unsigned int newtag = arg->ui & TAGMASK;
 	unsigned int curtag = selmon->tagset[selmon->seltags];
+	unsigned int tags;
 
 	if (newtag == curtag || !curtag || (curtag & (curtag - 1))) return;
 
 	for (Client *c = selmon->clients; c != NULL; c = c->next) {
-		if ((c->tags & newtag) || (c->tags & curtag)) c->tags ^= curtag ^ newtag;
+		tags = c->tags;
+		if ((tags & newtag) || (tags & curtag)) tags ^= curtag ^ newtag;
 
-		if (!c->tags) c->tags = newtag;
+		settags(c, tags ? tags : newtag);
 		setclienttagprop(c);
 	}
 
 	selmon->tagset[selmon->seltags] = newtag;
+	selmon->visvalid = 0;
 
 	focus(NULL);
 	arrange(selmon);
@@ -3443,7 +4254,7 @@ int main(int argc, char *argv[])
 	rules = get_rules();
 	setup();
 #ifdef __OpenBSD__
-	if (pledge("stdio rpath proc exec", NULL) == -1) die("pledge");
+	if (pledge("stdio rpath cpath proc exec unix", NULL) == -1) die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
 	autostart();
@@ -35,9 +35,11 @@ extern void toggletag(const Arg *arg);
 extern void toggleview(const Arg *arg);
 extern void view(const Arg *arg);
 extern void zoom(const Arg *arg);
+extern void dumpstats(const Arg *arg);
 extern void defaultgaps(const Arg *arg);
 extern void incrgaps(const Arg *arg);
 extern void togglegaps(const Arg *arg);
+extern void togglelazy(const Arg *arg);
 extern void bstack(Monitor *m);
 extern void centeredmaster(Monitor *m);
 extern void centeredfloatingmaster(Monitor *m);
@@ -25,15 +25,17 @@ struct Client {
 	int oldx, oldy, oldw, oldh;
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
 	int bw, oldbw;
+	int sentx, senty, sentw, senth, sentbw; /* last configured, sentw 0: unknown */
+	int lazy, lx, ly, lw, lh; /* geometry held back while occluded */
 	int issteam;
 	unsigned int icw, ich;
 	Picture icon;
 	unsigned int tags;
 	int isfixed, iscentered, isfloating, isurgent, neverfocus, oldstate, isfullscreen,
-		isterminal, noswallow, managedsize, issticky;
+		isterminal, noswallow, managedsize, issticky, ishidden;
 	pid_t pid;
-	Client *next;
-	Client *snext;
+	Client *next, *prev;
+	Client *snext, *sprev;
 	Client *curtagnext;
 	Client *swallowing;
 	Monitor *mon;
@@ -45,6 +47,40 @@ typedef struct {
 	void (*arrange)(Monitor *);
 } Layout;
 
+/* a tiled client as placed by a layout */
+typedef struct {
+	Client *c;
+	int x, y, w, h; /* geometry after size hints, as resize() would leave it */
+	int stacked; /* shares its area with other tiles, only the top one shows */
+} Tile;
+
+/* an arrangement remembered per monitor, reused while its key matches */
+#define LAYOUTCACHE 4
+typedef struct {
+	struct {
+		const Layout *lt;
+		float mfact;
+		int nmaster, gaps[5], area[4];
+		unsigned int tagset, gen;
+	} key;
+	char ltsymbol[16];
+	Tile *tiles;
+	unsigned int n, cap, used; /* used: lru tick, 0 for an empty slot */
+} LayoutCache;
+
+/* copy of a drawn bar part, redrawn only when the hash of its inputs changes */
+typedef struct {
+	Pixmap pix;
+	unsigned int w, hash;
+} BarSeg;
+
+/* clickable area [x0, x1) of the left part of the bar */
+#define MAXHITS 32
+typedef struct {
+	int x0, x1;
+	unsigned int click, arg; /* a Clk* value or pdwm's own, tag or button index */
+} BarHit;
+
 struct Monitor {
 	char ltsymbol[16];
 	float mfact;
@@ -67,10 +103,20 @@ struct Monitor {
 	Client *clients;
 	Client *sel;
 	Client *stack;
+	Client *vis; /* ISVISIBLE clients in client order, linked by curtagnext */
+	int visvalid; /* vis matches clients, tags and tagset */
 	Monitor *next;
 	Window barwin;
+	BarSeg barseg; /* left part: logo, tags, layout and config buttons */
+	BarHit hits[MAXHITS]; /* sorted by x, written by drawbar() */
+	int nhits;
+	LayoutCache ltcache[LAYOUTCACHE];
+	unsigned int ltgen, lttick; /* ltgen changes with anything the layouts read */
+	unsigned short nocc[32], nurg[32]; /* attached clients per tag bit */
+	unsigned int occ, urg; /* tag bits with nonzero counts */
 	const Layout *lt[2];
 	Pertag *pertag;
+	unsigned int dirty; /* Dirty* work deferred to the end of the event batch */
 };
 
 typedef union {
@@ -115,6 +161,14 @@ typedef struct Rule {
 
 /* enums */
 enum { CurNormal, CurResize, CurMove, CurLast }; /* cursor */
+enum {
+	DirtyLayout = 1 << 0,
+	DirtyStack = 1 << 1,
+	DirtyBarLeft = 1 << 2,
+	DirtyBarTitle = 1 << 3,
+	DirtyBarStatus = 1 << 4,
+	DirtyBar = DirtyBarLeft | DirtyBarTitle | DirtyBarStatus
+}; /* monitor dirty bits */
 enum {
 	SchemeNorm,
 	SchemeSel,
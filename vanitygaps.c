@@ -2,6 +2,7 @@
 void defaultgaps(const Arg *arg);
 void incrgaps(const Arg *arg);
 void togglegaps(const Arg *arg);
+void togglelazy(const Arg *arg);
 
 /* Layouts */
 void bstack(Monitor *m);
@@ -14,11 +15,153 @@ void spiral(Monitor *m);
 void tile(Monitor *);
 
 /* Internals */
-void getgaps(Monitor *m, int *oh, int *ov, int *ih, int *iv, unsigned int *nc);
+#define TWIDTH(T) ((T)->w + 2 * (T)->c->bw)
+#define THEIGHT(T) ((T)->h + 2 * (T)->c->bw)
+
+void applytiles(Monitor *m, Tile *tl, unsigned int n);
+int cachedlayout(Monitor *m);
+unsigned int gathertiles(Monitor *m);
+void getgaps(Monitor *m, unsigned int n, int *oh, int *ov, int *ih, int *iv);
+void layoutkey(Monitor *m, LayoutCache *lc);
+void place(Tile *t, int x, int y, int w, int h);
 void setgaps(int oh, int ov, int ih, int iv);
+void storelayout(Monitor *m);
+unsigned int tiled(Monitor *m);
 
 /* Settings */
 int enablegaps = 1;
+int occludelazy = 0; /* 1: configure occluded monocle and deck clients on focus */
+
+/* tiled clients of the monitor being arranged, gathered by arrangemon() */
+static Tile *tiles;
+static unsigned int ntiles, tilecap;
+static Monitor *tilesmon;
+static int tilesused; /* the layout asked for the tiles, see storelayout() */
+
+unsigned int gathertiles(Monitor *m)
+{
+	Client *c;
+
+	tilesmon = m;
+	tilesused = 0;
+	for (ntiles = 0, c = nexttiled(visible(m)); c; c = nexttiled(c->curtagnext)) {
+		if (ntiles == tilecap) {
+			tilecap = tilecap ? 2 * tilecap : 16;
+			if (!(tiles = realloc(tiles, tilecap * sizeof *tiles)))
+				die("realloc:");
+		}
+		tiles[ntiles++].c = c;
+	}
+	return ntiles;
+}
+
+/* the tiles of m, gathered here when a layout runs outside arrangemon() */
+unsigned int tiled(Monitor *m)
+{
+	if (tilesmon != m) gathertiles(m);
+	tilesused = 1;
+	return ntiles;
+}
+
+/* record where a tile goes; touches nothing but t, so layouts stay pure */
+void place(Tile *t, int x, int y, int w, int h)
+{
+	t->x = x;
+	t->y = y;
+	t->w = w;
+	t->h = h;
+	t->stacked = 0;
+	applysizehints(t->c, &t->x, &t->y, &t->w, &t->h, 0);
+}
+
+/*
+ * resizeclient() drops the tiles that did not move. With occludelazy, a stacked
+ * tile under the top one that already sits inside its area is left alone and
+ * gets its geometry from focus() once it comes up.
+ */
+void applytiles(Monitor *m, Tile *tl, unsigned int n)
+{
+	Tile *t;
+	Client *c, *top = NULL;
+
+	if (occludelazy) {
+		for (t = tl; t < tl + n; t++) t->c->lazy = t->stacked;
+		/* the visible tiled clients are exactly the tiles */
+		for (top = m->stack; top; top = top->snext)
+			if (top->lazy && ISVISIBLE(top) && !top->isfloating &&
+			    !HIDDEN(top))
+				break;
+	}
+	for (t = tl; t < tl + n; t++) {
+		c = t->c;
+		c->lazy = occludelazy && t->stacked && c != top && c->x >= t->x &&
+			  c->y >= t->y && c->x + WIDTH(c) <= t->x + TWIDTH(t) &&
+			  c->y + HEIGHT(c) <= t->y + THEIGHT(t);
+		if (!c->lazy) {
+			resizeclient(c, t->x, t->y, t->w, t->h);
+			continue;
+		}
+		c->lx = t->x;
+		c->ly = t->y;
+		c->lw = t->w;
+		c->lh = t->h;
+	}
+}
+
+void layoutkey(Monitor *m, LayoutCache *lc)
+{
+	memset(&lc->key, 0, sizeof lc->key);
+	lc->key.lt = m->lt[m->sellt];
+	lc->key.mfact = m->mfact;
+	lc->key.nmaster = m->nmaster;
+	lc->key.gaps[0] = m->gappoh;
+	lc->key.gaps[1] = m->gappov;
+	lc->key.gaps[2] = m->gappih;
+	lc->key.gaps[3] = m->gappiv;
+	lc->key.gaps[4] = enablegaps;
+	lc->key.area[0] = m->wx;
+	lc->key.area[1] = m->wy;
+	lc->key.area[2] = m->ww;
+	lc->key.area[3] = m->wh;
+	lc->key.tagset = m->tagset[m->seltags];
+	lc->key.gen = m->ltgen;
+}
+
+/* reapply a stored arrangement, resizeclient() then sends only what moved */
+int cachedlayout(Monitor *m)
+{
+	LayoutCache k, *lc;
+
+	layoutkey(m, &k);
+	for (lc = m->ltcache; lc < m->ltcache + LAYOUTCACHE; lc++)
+		if (lc->used && !memcmp(&lc->key, &k.key, sizeof k.key)) break;
+	if (lc == m->ltcache + LAYOUTCACHE) return 0;
+	lc->used = ++m->lttick;
+	memcpy(m->ltsymbol, lc->ltsymbol, sizeof m->ltsymbol);
+	applytiles(m, lc->tiles, lc->n);
+	layoutsreused++;
+	return 1;
+}
+
+/* remember what the layout just placed, in the least recently used slot */
+void storelayout(Monitor *m)
+{
+	LayoutCache *lc, *old;
+
+	if (tilesmon != m || !tilesused) return; /* a layout that ignores the tiles */
+	for (old = lc = m->ltcache; lc < m->ltcache + LAYOUTCACHE; lc++)
+		if (lc->used < old->used) old = lc;
+	if (old->cap < ntiles) {
+		old->cap = ntiles;
+		if (!(old->tiles = realloc(old->tiles, old->cap * sizeof *old->tiles)))
+			die("realloc:");
+	}
+	layoutkey(m, old);
+	memcpy(old->tiles, tiles, ntiles * sizeof *tiles);
+	memcpy(old->ltsymbol, m->ltsymbol, sizeof old->ltsymbol);
+	old->n = ntiles;
+	old->used = ++m->lttick;
+}
 
 void setgaps(int oh, int ov, int ih, int iv)
 {
@@ -40,6 +183,12 @@ void togglegaps(const Arg *arg)
 	arrange(NULL);
 }
 
+void togglelazy(const Arg *arg)
+{
+	occludelazy = !occludelazy;
+	arrange(NULL);
+}
+
 void defaultgaps(const Arg *arg)
 {
 	setgaps(gappoh, gappov, gappih, gappiv);
@@ -51,14 +200,11 @@ void incrgaps(const Arg *arg)
 		selmon->gappiv + arg->i);
 }
 
-void getgaps(Monitor *m, int *oh, int *ov, int *ih, int *iv, unsigned int *nc)
+void getgaps(Monitor *m, unsigned int n, int *oh, int *ov, int *ih, int *iv)
 {
-	unsigned int n, oe, ie;
+	unsigned int oe, ie;
 	oe = ie = enablegaps;
-	Client *c;
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++)
-		;
 	if (smartgaps && n == 1) {
 		oe = 0; // outer gaps disabled when only one client
 	}
@@ -67,23 +213,20 @@ void getgaps(Monitor *m, int *oh, int *ov, int *ih, int *iv, unsigned int *nc)
 	*ov = m->gappov * oe; // outer vertical gap
 	*ih = m->gappih * ie; // inner horizontal gap
 	*iv = m->gappiv * ie; // inner vertical gap
-	*nc = n; // number of clients
 }
 
-void getfacts(Monitor *m, int msize, int ssize, float *mf, float *sf, int *mr, int *sr)
+void getfacts(Monitor *m, unsigned int n, int msize, int ssize, float *mf, float *sf,
+	      int *mr, int *sr)
 {
-	unsigned int n;
+	unsigned int i;
 	float mfacts, sfacts;
 	int mtotal = 0, stotal = 0;
-	Client *c;
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++)
-		;
 	mfacts = MIN(n, m->nmaster);
 	sfacts = n - m->nmaster;
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++)
-		if (n < m->nmaster)
+	for (i = 0; i < n; i++)
+		if (i < m->nmaster)
 			mtotal += msize / mfacts;
 		else
 			stotal += ssize / sfacts;
@@ -110,10 +253,11 @@ void bstack(Monitor *m)
 	int sx = 0, sy = 0, sh = 0, sw = 0;
 	float mfacts, sfacts;
 	int mrest, srest;
-	Client *c;
+	Tile *t;
 
 	int oh, ov, ih, iv;
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n == 0) return;
 
@@ -130,22 +274,23 @@ void bstack(Monitor *m)
 		sy = my + mh + ih;
 	}
 
-	getfacts(m, mw, sw, &mfacts, &sfacts, &mrest, &srest);
+	getfacts(m, n, mw, sw, &mfacts, &sfacts, &mrest, &srest);
 
-	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++) {
+	for (i = 0, t = tiles; i < n; i++, t++) {
 		if (i < m->nmaster) {
-			resize(c, mx, my,
-			       (mw / mfacts) + (i < mrest ? 1 : 0) - (2 * c->bw),
-			       mh - (2 * c->bw), 0);
-			mx += WIDTH(c) + iv;
+			place(t, mx, my,
+			      (mw / mfacts) + (i < mrest ? 1 : 0) - (2 * t->c->bw),
+			      mh - (2 * t->c->bw));
+			mx += TWIDTH(t) + iv;
 		} else {
-			resize(c, sx, sy,
-			       (sw / sfacts) + ((i - m->nmaster) < srest ? 1 : 0) -
-				       (2 * c->bw),
-			       sh - (2 * c->bw), 0);
-			sx += WIDTH(c) + iv;
+			place(t, sx, sy,
+			      (sw / sfacts) + ((i - m->nmaster) < srest ? 1 : 0) -
+				      (2 * t->c->bw),
+			      sh - (2 * t->c->bw));
+			sx += TWIDTH(t) + iv;
 		}
 	}
+	applytiles(m, tiles, n);
 }
 
 /*
@@ -162,10 +307,11 @@ void centeredmaster(Monitor *m)
 	float mfacts = 0, lfacts = 0, rfacts = 0;
 	int mtotal = 0, ltotal = 0, rtotal = 0;
 	int mrest = 0, lrest = 0, rrest = 0;
-	Client *c;
+	Tile *t;
 
 	int oh, ov, ih, iv;
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n == 0) return;
 
@@ -199,19 +345,19 @@ void centeredmaster(Monitor *m)
 	}
 
 	/* calculate facts */
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++) {
-		if (!m->nmaster || n < m->nmaster)
+	for (i = 0; i < n; i++) {
+		if (!m->nmaster || i < m->nmaster)
 			mfacts += 1;
-		else if ((n - m->nmaster) % 2)
+		else if ((i - m->nmaster) % 2)
 			lfacts += 1; // total factor of left hand stack area
 		else
 			rfacts += 1; // total factor of right hand stack area
 	}
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++)
-		if (!m->nmaster || n < m->nmaster)
+	for (i = 0; i < n; i++)
+		if (!m->nmaster || i < m->nmaster)
 			mtotal += mh / mfacts;
-		else if ((n - m->nmaster) % 2)
+		else if ((i - m->nmaster) % 2)
 			ltotal += lh / lfacts;
 		else
 			rtotal += rh / rfacts;
@@ -220,33 +366,30 @@ void centeredmaster(Monitor *m)
 	lrest = lh - ltotal;
 	rrest = rh - rtotal;
 
-	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++) {
+	for (i = 0, t = tiles; i < n; i++, t++) {
 		if (!m->nmaster || i < m->nmaster) {
 			/* nmaster clients are stacked vertically, in the center of the screen */
-			resize(c, mx, my, mw - (2 * c->bw),
-			       (mh / mfacts) + (i < mrest ? 1 : 0) - (2 * c->bw), 0);
-			my += HEIGHT(c) + ih;
+			place(t, mx, my, mw - (2 * t->c->bw),
+			      (mh / mfacts) + (i < mrest ? 1 : 0) - (2 * t->c->bw));
+			my += THEIGHT(t) + ih;
 		} else {
 			/* stack clients are stacked vertically */
 			if ((i - m->nmaster) % 2) {
-				resize(c, lx, ly, lw - (2 * c->bw),
-				       (lh / lfacts) +
-					       ((i - 2 * m->nmaster) < 2 * lrest ? 1 :
-										   0) -
-					       (2 * c->bw),
-				       0);
-				ly += HEIGHT(c) + ih;
+				place(t, lx, ly, lw - (2 * t->c->bw),
+				      (lh / lfacts) +
+					      ((i - 2 * m->nmaster) < 2 * lrest ? 1 : 0) -
+					      (2 * t->c->bw));
+				ly += THEIGHT(t) + ih;
 			} else {
-				resize(c, rx, ry, rw - (2 * c->bw),
-				       (rh / rfacts) +
-					       ((i - 2 * m->nmaster) < 2 * rrest ? 1 :
-										   0) -
-					       (2 * c->bw),
-				       0);
-				ry += HEIGHT(c) + ih;
+				place(t, rx, ry, rw - (2 * t->c->bw),
+				      (rh / rfacts) +
+					      ((i - 2 * m->nmaster) < 2 * rrest ? 1 : 0) -
+					      (2 * t->c->bw));
+				ry += THEIGHT(t) + ih;
 			}
 		}
 	}
+	applytiles(m, tiles, n);
 }
 
 void centeredfloatingmaster(Monitor *m)
@@ -256,11 +399,12 @@ void centeredfloatingmaster(Monitor *m)
 	int mrest, srest;
 	int mx = 0, my = 0, mh = 0, mw = 0;
 	int sx = 0, sy = 0, sh = 0, sw = 0;
-	Client *c;
+	Tile *t;
 
 	float mivf = 1.0; // master inner vertical gap factor
 	int oh, ov, ih, iv;
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n == 0) return;
 
@@ -288,23 +432,24 @@ void centeredfloatingmaster(Monitor *m)
 		sh = (m->wh - sb_padding_y) - 2 * oh;
 	}
 
-	getfacts(m, mw, sw, &mfacts, &sfacts, &mrest, &srest);
+	getfacts(m, n, mw, sw, &mfacts, &sfacts, &mrest, &srest);
 
-	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++)
+	for (i = 0, t = tiles; i < n; i++, t++)
 		if (i < m->nmaster) {
 			/* nmaster clients are stacked horizontally, in the center of the screen */
-			resize(c, mx, my,
-			       (mw / mfacts) + (i < mrest ? 1 : 0) - (2 * c->bw),
-			       mh - (2 * c->bw), 0);
-			mx += WIDTH(c) + iv * mivf;
+			place(t, mx, my,
+			      (mw / mfacts) + (i < mrest ? 1 : 0) - (2 * t->c->bw),
+			      mh - (2 * t->c->bw));
+			mx += TWIDTH(t) + iv * mivf;
 		} else {
 			/* stack clients are stacked horizontally */
-			resize(c, sx, sy,
-			       (sw / sfacts) + ((i - m->nmaster) < srest ? 1 : 0) -
-				       (2 * c->bw),
-			       sh - (2 * c->bw), 0);
-			sx += WIDTH(c) + iv;
+			place(t, sx, sy,
+			      (sw / sfacts) + ((i - m->nmaster) < srest ? 1 : 0) -
+				      (2 * t->c->bw),
+			      sh - (2 * t->c->bw));
+			sx += TWIDTH(t) + iv;
 		}
+	applytiles(m, tiles, n);
 }
 
 /*
@@ -319,10 +464,11 @@ void deck(Monitor *m)
 	int sx = 0, sy = 0, sh = 0, sw = 0;
 	float mfacts, sfacts;
 	int mrest, srest;
-	Client *c;
+	Tile *t;
 
 	int oh, ov, ih, iv;
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n == 0) return;
 
@@ -338,19 +484,21 @@ void deck(Monitor *m)
 		sh = (m->wh - sb_padding_y) - 2 * oh;
 	}
 
-	getfacts(m, mh, sh, &mfacts, &sfacts, &mrest, &srest);
+	getfacts(m, n, mh, sh, &mfacts, &sfacts, &mrest, &srest);
 
 	if (n - m->nmaster > 0) /* override layout symbol */
 		snprintf(m->ltsymbol, sizeof m->ltsymbol, "D %d", n - m->nmaster);
 
-	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++)
+	for (i = 0, t = tiles; i < n; i++, t++)
 		if (i < m->nmaster) {
-			resize(c, mx, my, mw - (2 * c->bw),
-			       (mh / mfacts) + (i < mrest ? 1 : 0) - (2 * c->bw), 0);
-			my += HEIGHT(c) + ih;
+			place(t, mx, my, mw - (2 * t->c->bw),
+			      (mh / mfacts) + (i < mrest ? 1 : 0) - (2 * t->c->bw));
+			my += THEIGHT(t) + ih;
 		} else {
-			resize(c, sx, sy, sw - (2 * c->bw), sh - (2 * c->bw), 0);
+			place(t, sx, sy, sw - (2 * t->c->bw), sh - (2 * t->c->bw));
+			t->stacked = 1;
 		}
+	applytiles(m, tiles, n);
 }
 
 /*
@@ -363,9 +511,10 @@ void fibonacci(Monitor *m, int s)
 	unsigned int i, n;
 	int nx, ny, nw, nh;
 	int oh, ov, ih, iv;
-	Client *c;
+	Tile *t;
 
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n == 0) return;
 
@@ -374,8 +523,9 @@ void fibonacci(Monitor *m, int s)
 	nw = m->ww - 2 * ov;
 	nh = (m->wh - sb_padding_y) - 2 * oh;
 
-	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next)) {
-		if ((i % 2 && nh / 2 > 2 * c->bw) || (!(i % 2) && nw / 2 > 2 * c->bw)) {
+	for (i = 0, t = tiles; t < tiles + n; t++) {
+		if ((i % 2 && nh / 2 > 2 * t->c->bw) ||
+		    (!(i % 2) && nw / 2 > 2 * t->c->bw)) {
 			if (i < n - 1) {
 				if (i % 2)
 					nh = (nh - ih) / 2;
@@ -410,8 +560,9 @@ void fibonacci(Monitor *m, int s)
 			i++;
 		}
 
-		resize(c, nx, ny, nw - (2 * c->bw), nh - (2 * c->bw), False);
+		place(t, nx, ny, nw - (2 * t->c->bw), nh - (2 * t->c->bw));
 	}
+	applytiles(m, tiles, n);
 }
 
 void dwindle(Monitor *m)
@@ -435,10 +586,11 @@ void tile(Monitor *m)
 	int sx = 0, sy = 0, sh = 0, sw = 0;
 	float mfacts, sfacts;
 	int mrest, srest;
-	Client *c;
+	Tile *t;
 
 	int oh, ov, ih, iv;
-	getgaps(m, &oh, &ov, &ih, &iv, &n);
+	n = tiled(m);
+	getgaps(m, n, &oh, &ov, &ih, &iv);
 
 	if (n == 0) return;
 
@@ -454,18 +606,18 @@ void tile(Monitor *m)
 		sx = mx + mw + iv;
 	}
 
-	getfacts(m, mh, sh, &mfacts, &sfacts, &mrest, &srest);
+	getfacts(m, n, mh, sh, &mfacts, &sfacts, &mrest, &srest);
 
-	for (i = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++)
+	for (i = 0, t = tiles; i < n; i++, t++)
 		if (i < m->nmaster) {
-			resize(c, mx, my, mw - (2 * c->bw),
-			       (mh / mfacts) + (i < mrest ? 1 : 0) - (2 * c->bw), 0);
-			my += HEIGHT(c) + ih;
+			place(t, mx, my, mw - (2 * t->c->bw),
+			      (mh / mfacts) + (i < mrest ? 1 : 0) - (2 * t->c->bw));
+			my += THEIGHT(t) + ih;
 		} else {
-			resize(c, sx, sy, sw - (2 * c->bw),
-			       (sh / sfacts) + ((i - m->nmaster) < srest ? 1 : 0) -
-				       (2 * c->bw),
-			       0);
-			sy += HEIGHT(c) + ih;
+			place(t, sx, sy, sw - (2 * t->c->bw),
+			      (sh / sfacts) + ((i - m->nmaster) < srest ? 1 : 0) -
+				      (2 * t->c->bw));
+			sy += THEIGHT(t) + ih;
 		}
+	applytiles(m, tiles, n);
 }